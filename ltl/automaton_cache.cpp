@@ -0,0 +1,141 @@
+// Copyright (c) 2020 Klemens Esterle, Luis Gressenbuch
+//
+// This work is licensed under the terms of the MIT license.
+// For a copy, see <https://opensource.org/licenses/MIT>.
+
+#include "ltl/automaton_cache.h"
+
+#include <cctype>
+#include <sstream>
+#include <stdexcept>
+#include <utility>
+
+#include "glog/logging.h"
+#include "spot/tl/hierarchy.hh"
+#include "spot/tl/ltlf.hh"
+#include "spot/tl/parse.hh"
+#include "spot/tl/print.hh"
+#include "spot/twaalgos/translate.hh"
+
+namespace ltl {
+
+TranslatedAutomaton::~TranslatedAutomaton() {
+  if (aut) {
+    // Destroying the automaton frees BDDs, which BuDDy does not synchronize
+    auto spot_lock = AutomatonCache::LockSpot();
+    aut.reset();
+  }
+}
+
+AutomatonCache& AutomatonCache::GetInstance() {
+  static AutomatonCache cache;
+  return cache;
+}
+
+AutomatonCache::TranslatedAutomatonPtr AutomatonCache::Get(
+    const std::string& agent_free_formula) {
+  const std::string key = Normalize(agent_free_formula);
+  std::promise<TranslatedAutomatonPtr> promise;
+  std::shared_future<TranslatedAutomatonPtr> future;
+  bool is_miss = false;
+  {
+    std::lock_guard<std::mutex> lock(mutex_);
+    auto it = entries_.find(key);
+    if (it != entries_.end()) {
+      future = it->second;
+    } else {
+      future = promise.get_future().share();
+      entries_.insert({key, future});
+      is_miss = true;
+    }
+  }
+  if (is_miss) {
+    // Translate outside of the cache lock, so other formulas can be looked up
+    try {
+      promise.set_value(Translate(key));
+    } catch (...) {
+      {
+        // Later requests translate again instead of getting this error
+        std::lock_guard<std::mutex> lock(mutex_);
+        entries_.erase(key);
+      }
+      promise.set_exception(std::current_exception());
+    }
+  }
+  return future.get();
+}
+
+size_t AutomatonCache::Size() const {
+  std::lock_guard<std::mutex> lock(mutex_);
+  return entries_.size();
+}
+
+void AutomatonCache::Clear() {
+  std::lock_guard<std::mutex> lock(mutex_);
+  entries_.clear();
+}
+
+std::unique_lock<std::recursive_mutex> AutomatonCache::LockSpot() {
+  static std::recursive_mutex spot_mutex;
+  return std::unique_lock<std::recursive_mutex>(spot_mutex);
+}
+
+AutomatonCache::TranslatedAutomatonPtr AutomatonCache::Translate(
+    const std::string& formula) {
+  auto spot_lock = LockSpot();
+  spot::parsed_formula pf = spot::parse_infix_psl(formula);
+  if (!pf.errors.empty()) {
+    std::ostringstream errors;
+    errors << "Invalid formula " << formula << ":\n";
+    pf.format_errors(errors);
+    throw std::invalid_argument(errors.str());
+  }
+  const spot::formula ltl_formula = pf.f;
+  spot::translator trans;
+  trans.set_pref(spot::postprocessor::Deterministic);
+  trans.set_type(spot::postprocessor::BA);
+  spot::twa_graph_ptr aut = trans.run(spot::from_ltlf(ltl_formula));
+
+  // If formula has the safety property, also accept empty words.
+  if (spot::mp_class(ltl_formula) == 'S') {
+    // Find unique accepting state
+    size_t final_state;
+    for (final_state = 0; final_state < aut->num_states(); ++final_state) {
+      if (aut->state_is_accepting(final_state)) {
+        break;
+      }
+    }
+    // Create transition from init state to final state, accepting empty words
+    bdd alive_bdd = bdd_ithvar(aut->get_dict()->has_registered_proposition(
+        spot::formula::ap("alive"), aut));
+    aut->new_edge(aut->get_init_state_number(), final_state, !alive_bdd);
+  }
+
+  auto translated = std::make_shared<TranslatedAutomaton>();
+  translated->aut = aut;
+  translated->compiled = std::make_shared<const CompiledAutomaton>(aut);
+  translated->formula_str = spot::str_psl(ltl_formula);
+  VLOG(1) << "Translated " << formula << " into " << aut->num_states()
+          << " states";
+  return translated;
+}
+
+std::string AutomatonCache::Normalize(const std::string& formula) {
+  // Collapse whitespace, it never changes the meaning of a formula
+  std::string normalized;
+  bool pending_space = false;
+  for (char c : formula) {
+    if (std::isspace(static_cast<unsigned char>(c))) {
+      pending_space = !normalized.empty();
+    } else {
+      if (pending_space) {
+        normalized += ' ';
+        pending_space = false;
+      }
+      normalized += c;
+    }
+  }
+  return normalized;
+}
+
+}  // namespace ltl
@@ -0,0 +1,67 @@
+// Copyright (c) 2020 Klemens Esterle, Luis Gressenbuch
+//
+// This work is licensed under the terms of the MIT license.
+// For a copy, see <https://opensource.org/licenses/MIT>.
+
+#ifndef LTL_AUTOMATON_CACHE_H_
+#define LTL_AUTOMATON_CACHE_H_
+
+#include <future>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <unordered_map>
+
+#include "ltl/compiled_automaton.h"
+#include "spot/twa/twagraph.hh"
+
+namespace ltl {
+
+/// Automaton of an agent-free LTLf formula, as used by RuleMonitor.
+struct TranslatedAutomaton {
+  /// Releases aut while holding AutomatonCache::LockSpot.
+  ~TranslatedAutomaton();
+
+  // Deterministic Büchi automaton, including the alive edge for safety rules
+  spot::twa_graph_ptr aut;
+  std::shared_ptr<const CompiledAutomaton> compiled;
+  // Formula as printed by Spot
+  std::string formula_str;
+};
+
+/// Process-wide, thread-safe cache of translated and compiled automata.
+///
+/// Entries are keyed by the agent-free formula with normalized whitespace, so
+/// identical rules share one automaton regardless of the agents they are
+/// instantiated for. Each formula is translated at most once, concurrent
+/// requests for the same formula wait for the first translation. Failed
+/// translations are not cached, their waiters get the same exception.
+class AutomatonCache {
+ public:
+  typedef std::shared_ptr<const TranslatedAutomaton> TranslatedAutomatonPtr;
+
+  static AutomatonCache& GetInstance();
+
+  /// Returns the automaton of formula, translating it on a cache miss.
+  /// Throws std::invalid_argument if formula cannot be parsed.
+  TranslatedAutomatonPtr Get(const std::string& agent_free_formula);
+  size_t Size() const;
+  void Clear();
+
+  /// Spot and BuDDy are not thread-safe. Every use of them, including copies
+  /// of spot::formula, must happen while holding this lock.
+  static std::unique_lock<std::recursive_mutex> LockSpot();
+
+ private:
+  AutomatonCache() = default;
+  static TranslatedAutomatonPtr Translate(const std::string& formula);
+  static std::string Normalize(const std::string& formula);
+
+  mutable std::mutex mutex_;
+  std::unordered_map<std::string, std::shared_future<TranslatedAutomatonPtr>>
+      entries_;
+};
+
+}  // namespace ltl
+
+#endif  // LTL_AUTOMATON_CACHE_H_
@@ -0,0 +1,244 @@
+// Copyright (c) 2020 Klemens Esterle, Luis Gressenbuch
+//
+// This work is licensed under the terms of the MIT license.
+// For a copy, see <https://opensource.org/licenses/MIT>.
+
+#include <string>
+#include <vector>
+
+#include "benchmark/benchmark.h"
+#include "bark/world/evaluation/ltl/label/label.h"
+#include "ltl/automaton_cache.h"
+#include "ltl/label_frame.h"
+#include "ltl/rule_monitor.h"
+#include "ltl/rule_state_arena.h"
+#include "ltl/rule_state_set.h"
+
+using namespace ltl;
+using RuleMonitorSPtr = RuleMonitor::RuleMonitorSPtr;
+
+namespace {
+
+// Traffic rules, including the zipper merge formula of
+// zipper_merge_formula_test.cpp
+const std::vector<std::string> kTrafficFormulas = {
+    "(in_direct_front_x & !merged_e & (in_direct_front_x | merged_x) U "
+    "merged_e) -> G(merged_e & merged_x -> !in_direct_front_x)",
+    "G (!collision_e)",
+    "G (in_direct_front_e_x#0 -> safe_distance_e_x#0)",
+    "G ((lane_change_e & !indicator_e) -> !right_of_e_x#0)",
+    "G (speed_limit_exceeded_e -> F !speed_limit_exceeded_e)",
+    "G (sl_e & overtaking_e_x#0 -> X (F (right_of_e_x#0 & !sl_e)))",
+    "(F merged_e) & G (on_road_e)",
+};
+
+// Rule whose automaton has num_labels + 1 states: p_0, ..., p_n have to
+// become true in this order
+std::string MakeSequenceFormula(int num_labels) {
+  std::string formula;
+  for (int i = 0; i < num_labels; ++i) {
+    formula += "F (p_" + std::to_string(i) + (i + 1 < num_labels ? " & " : "");
+  }
+  return formula + std::string(num_labels, ')');
+}
+
+// Rule with the given number of placeholders, labels q_i#i
+std::string MakeArityFormula(int arity) {
+  std::string formula = "G (q_0#0";
+  for (int i = 1; i < arity; ++i) {
+    formula += " & q_" + std::to_string(i) + "#" + std::to_string(i);
+  }
+  return formula + ")";
+}
+
+EvaluationMap MakeSequenceLabels(int num_labels, int step) {
+  EvaluationMap labels;
+  for (int i = 0; i < num_labels; ++i) {
+    labels[Label("p_" + std::to_string(i))] = (step % num_labels) == i;
+  }
+  return labels;
+}
+
+}  // namespace
+
+static void BM_MakeRule(benchmark::State& state) {
+  const std::string& formula = kTrafficFormulas[state.range(0)];
+  for (auto _ : state) {
+    // Measure the translation, not the automaton cache
+    state.PauseTiming();
+    AutomatonCache::GetInstance().Clear();
+    state.ResumeTiming();
+    benchmark::DoNotOptimize(RuleMonitor::MakeRule(formula, -1.0, 0));
+  }
+}
+BENCHMARK(BM_MakeRule)->DenseRange(0, kTrafficFormulas.size() - 1);
+
+static void BM_Deserialize(benchmark::State& state) {
+  const std::string data =
+      RuleMonitor::MakeRule(kTrafficFormulas[state.range(0)], -1.0, 0)
+          ->Serialize();
+  for (auto _ : state) {
+    benchmark::DoNotOptimize(RuleMonitor::Deserialize(data));
+  }
+  state.counters["bytes"] = data.size();
+}
+BENCHMARK(BM_Deserialize)->DenseRange(0, kTrafficFormulas.size() - 1);
+
+static void BM_Evaluate(benchmark::State& state) {
+  const int num_labels = state.range(0);
+  RuleMonitorSPtr rule =
+      RuleMonitor::MakeRule(MakeSequenceFormula(num_labels), -1.0, 0);
+  RuleState rule_state = rule->MakeRuleState()[0];
+  std::vector<EvaluationMap> trace;
+  for (int step = 0; step < num_labels; ++step) {
+    trace.push_back(MakeSequenceLabels(num_labels, step));
+  }
+  size_t step = 0;
+  for (auto _ : state) {
+    benchmark::DoNotOptimize(
+        rule->Evaluate(trace[step++ % trace.size()], rule_state));
+  }
+  state.SetItemsProcessed(state.iterations());
+}
+BENCHMARK(BM_Evaluate)->RangeMultiplier(2)->Range(1, 32);
+
+static void BM_EvaluateFrame(benchmark::State& state) {
+  const int num_labels = state.range(0);
+  auto registry = std::make_shared<LabelRegistry>();
+  RuleMonitorSPtr rule =
+      RuleMonitor::MakeRule(MakeSequenceFormula(num_labels), -1.0, 0);
+  rule->BindLabels(registry);
+  RuleState rule_state = rule->MakeRuleState()[0];
+  std::vector<LabelFrame> trace;
+  for (int step = 0; step < num_labels; ++step) {
+    trace.push_back(LabelFrame::FromEvaluationMap(
+        *registry, MakeSequenceLabels(num_labels, step)));
+  }
+  size_t step = 0;
+  for (auto _ : state) {
+    benchmark::DoNotOptimize(
+        rule->Evaluate(trace[step++ % trace.size()], rule_state));
+  }
+  state.SetItemsProcessed(state.iterations());
+}
+BENCHMARK(BM_EvaluateFrame)->RangeMultiplier(2)->Range(1, 32);
+
+static void BM_FinalTransit(benchmark::State& state) {
+  const int num_labels = state.range(0);
+  RuleMonitorSPtr rule =
+      RuleMonitor::MakeRule(MakeSequenceFormula(num_labels), -1.0, 0);
+  RuleState rule_state = rule->MakeRuleState()[0];
+  rule->Evaluate(MakeSequenceLabels(num_labels, 0), rule_state);
+  for (auto _ : state) {
+    benchmark::DoNotOptimize(rule->FinalTransit(rule_state));
+  }
+}
+BENCHMARK(BM_FinalTransit)->RangeMultiplier(2)->Range(1, 32);
+
+static void BM_MakeRuleState(benchmark::State& state) {
+  const int num_agents = state.range(0);
+  RuleMonitorSPtr rule =
+      RuleMonitor::MakeRule(MakeArityFormula(state.range(1)), -1.0, 0);
+  std::vector<int> agent_ids;
+  for (int id = 0; id < num_agents; ++id) {
+    agent_ids.push_back(id);
+  }
+  size_t num_states = 0;
+  for (auto _ : state) {
+    num_states = rule->MakeRuleState(agent_ids).size();
+  }
+  state.counters["rule_states"] = num_states;
+  state.SetItemsProcessed(state.iterations() * num_states);
+}
+BENCHMARK(BM_MakeRuleState)
+    ->ArgNames({"agents", "arity"})
+    ->ArgsProduct({{2, 4, 8, 16, 32}, {1, 2, 3}});
+
+static void BM_AddAgent(benchmark::State& state) {
+  const int num_agents = state.range(0);
+  RuleMonitorSPtr rule =
+      RuleMonitor::MakeRule(MakeArityFormula(state.range(1)), -1.0, 0);
+  std::vector<int> agent_ids;
+  for (int id = 0; id < num_agents; ++id) {
+    agent_ids.push_back(id);
+  }
+  for (auto _ : state) {
+    state.PauseTiming();
+    RuleStateSet states = rule->MakeRuleStateSet(agent_ids);
+    state.ResumeTiming();
+    // One agent enters the scene
+    states.AddAgents({num_agents});
+    benchmark::DoNotOptimize(states.Size());
+  }
+}
+BENCHMARK(BM_AddAgent)
+    ->ArgNames({"agents", "arity"})
+    ->ArgsProduct({{2, 4, 8, 16, 32}, {1, 2, 3}});
+
+static void BM_EvaluateRuleStateSet(benchmark::State& state) {
+  const int num_agents = state.range(0);
+  RuleMonitorSPtr rule = RuleMonitor::MakeRule(MakeArityFormula(2), -1.0, 0);
+  std::vector<int> agent_ids;
+  EvaluationMap labels;
+  for (int id = 0; id < num_agents; ++id) {
+    agent_ids.push_back(id);
+    labels[Label("q_0", id)] = true;
+    labels[Label("q_1", id)] = true;
+  }
+  RuleStateSet states = rule->MakeRuleStateSet(agent_ids);
+  for (auto _ : state) {
+    benchmark::DoNotOptimize(states.Evaluate(labels));
+  }
+  state.SetItemsProcessed(state.iterations() * states.Size());
+}
+BENCHMARK(BM_EvaluateRuleStateSet)->RangeMultiplier(2)->Range(2, 32);
+
+static void BM_RuleStateArenaEpisode(benchmark::State& state) {
+  const int num_agents = state.range(0);
+  RuleMonitorSPtr rule = RuleMonitor::MakeRule(MakeArityFormula(2), -1.0, 0);
+  std::vector<int> agent_ids;
+  EvaluationMap labels;
+  for (int id = 0; id < num_agents; ++id) {
+    agent_ids.push_back(id);
+    labels[Label("q_0", id)] = true;
+    labels[Label("q_1", id)] = true;
+  }
+  RuleStateArena arena;
+  // Episodes of creating all states and taking one step
+  for (auto _ : state) {
+    arena.Reset();
+    arena.AddAgents(*rule, agent_ids);
+    benchmark::DoNotOptimize(
+        arena.Evaluate(labels, 0, arena.Size(), nullptr));
+  }
+  state.SetItemsProcessed(state.iterations() * arena.Size());
+}
+BENCHMARK(BM_RuleStateArenaEpisode)->RangeMultiplier(2)->Range(2, 32);
+
+static void BM_EvaluateTrace(benchmark::State& state) {
+  const int num_agents = state.range(0);
+  const size_t num_steps = 1000;
+  auto registry = std::make_shared<LabelRegistry>();
+  RuleMonitorSPtr rule = RuleMonitor::MakeRule(MakeArityFormula(2), -1.0, 0);
+  rule->BindLabels(registry);
+  std::vector<int> agent_ids;
+  for (int id = 0; id < num_agents; ++id) {
+    agent_ids.push_back(id);
+  }
+  RuleStateSet states = rule->MakeRuleStateSet(agent_ids);
+  LabelTrace trace(num_steps, *registry);
+  for (size_t t = 0; t < num_steps; ++t) {
+    for (int id : agent_ids) {
+      trace.Set(t, registry->GetSlot(Label("q_0", id)), (t + id) % 7 != 0);
+      trace.Set(t, registry->GetSlot(Label("q_1", id)), true);
+    }
+  }
+  RuleStateSet::TraceResult result;
+  for (auto _ : state) {
+    states.EvaluateTrace(trace, &result);
+  }
+  state.SetItemsProcessed(state.iterations() * num_steps * states.Size());
+}
+BENCHMARK(BM_EvaluateTrace)->RangeMultiplier(2)->Range(2, 32);
+
+BENCHMARK_MAIN();
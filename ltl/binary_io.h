@@ -0,0 +1,150 @@
+// Copyright (c) 2020 Klemens Esterle, Luis Gressenbuch
+//
+// This work is licensed under the terms of the MIT license.
+// For a copy, see <https://opensource.org/licenses/MIT>.
+
+#ifndef LTL_BINARY_IO_H_
+#define LTL_BINARY_IO_H_
+
+#include <cstdint>
+#include <cstring>
+#include <stdexcept>
+#include <string>
+#include <type_traits>
+#include <vector>
+
+namespace ltl {
+
+/// Rejects serialized data failing a validity check. Throws instead of
+/// aborting, as the data may come from untrusted sources like pickles.
+inline void CheckData(bool valid, const char* message = "Corrupt rule data!") {
+  if (!valid) {
+    throw std::invalid_argument(message);
+  }
+}
+
+/// Appends trivially copyable values, strings and vectors in native byte
+/// order. Used by the serialization of compiled rules.
+class BinaryWriter {
+ public:
+  explicit BinaryWriter(std::string* out) : out_(out), begin_(out->size()) {}
+
+  template <typename T>
+  void Write(const T& value) {
+    static_assert(std::is_trivially_copyable<T>::value, "POD required");
+    out_->append(reinterpret_cast<const char*>(&value), sizeof(T));
+  }
+  void Write(const std::string& value) {
+    Write<uint64_t>(value.size());
+    out_->append(value);
+  }
+  template <typename T>
+  void Write(const std::vector<T>& values) {
+    static_assert(std::is_trivially_copyable<T>::value, "POD required");
+    Write<uint64_t>(values.size());
+    out_->append(reinterpret_cast<const char*>(values.data()),
+                 values.size() * sizeof(T));
+  }
+  void Write(const std::vector<std::string>& values) {
+    Write<uint64_t>(values.size());
+    for (const auto& value : values) {
+      Write(value);
+    }
+  }
+  /// Write values such that they start at a multiple of kAlignment, so they
+  /// can be accessed in place, see BinaryReader::ReadAlignedArray.
+  template <typename T>
+  void WriteAligned(const std::vector<T>& values) {
+    static_assert(alignof(T) <= kAlignment, "Alignment not supported");
+    Write<uint64_t>(values.size());
+    Align();
+    WriteBytes(reinterpret_cast<const char*>(values.data()),
+               values.size() * sizeof(T));
+  }
+  void WriteBytes(const char* data, size_t size) { out_->append(data, size); }
+  /// Pad with zeros to the next multiple of kAlignment.
+  void Align() {
+    const size_t size = out_->size() - begin_;
+    out_->append((kAlignment - size % kAlignment) % kAlignment, '\0');
+  }
+
+  static constexpr size_t kAlignment = 8;
+
+ private:
+  std::string* out_;
+  size_t begin_;
+};
+
+/// Reads what BinaryWriter wrote from a (possibly memory-mapped) buffer.
+/// Reading past the end of the buffer throws std::invalid_argument.
+class BinaryReader {
+ public:
+  BinaryReader(const char* data, size_t size)
+      : data_(data), size_(size), pos_(0) {}
+
+  template <typename T>
+  T Read() {
+    static_assert(std::is_trivially_copyable<T>::value, "POD required");
+    T value;
+    std::memcpy(&value, Consume(sizeof(T)), sizeof(T));
+    return value;
+  }
+  std::string ReadString() {
+    const uint64_t size = Read<uint64_t>();
+    return std::string(Consume(size), size);
+  }
+  template <typename T>
+  std::vector<T> ReadVector() {
+    static_assert(std::is_trivially_copyable<T>::value, "POD required");
+    const uint64_t size = Read<uint64_t>();
+    CheckData(size <= (size_ - pos_) / sizeof(T));
+    std::vector<T> values(size);
+    std::memcpy(values.data(), Consume(size * sizeof(T)), size * sizeof(T));
+    return values;
+  }
+  std::vector<std::string> ReadStringVector() {
+    const uint64_t size = Read<uint64_t>();
+    std::vector<std::string> values;
+    for (uint64_t i = 0; i < size; ++i) {
+      values.push_back(ReadString());
+    }
+    return values;
+  }
+  /// Pointer to the values written by BinaryWriter::WriteAligned, which
+  /// remains valid as long as the buffer. If the buffer itself is not aligned
+  /// the pointer may be misaligned, see IsAligned.
+  template <typename T>
+  const T* ReadAlignedArray(uint64_t* size) {
+    static_assert(std::is_trivially_copyable<T>::value, "POD required");
+    *size = Read<uint64_t>();
+    Align();
+    CheckData(*size <= (size_ - pos_) / sizeof(T));
+    return reinterpret_cast<const T*>(Consume(*size * sizeof(T)));
+  }
+  template <typename T>
+  static bool IsAligned(const T* ptr) {
+    return reinterpret_cast<uintptr_t>(ptr) % alignof(T) == 0;
+  }
+  void Align() {
+    Consume((BinaryWriter::kAlignment - pos_ % BinaryWriter::kAlignment) %
+            BinaryWriter::kAlignment);
+  }
+  void Skip(size_t size) { Consume(size); }
+  size_t GetPosition() const { return pos_; }
+
+ private:
+  const char* Consume(size_t size) {
+    CheckData(size <= size_ - pos_);
+    const char* begin = data_ + pos_;
+    pos_ += size;
+    return begin;
+  }
+
+  const char* data_;
+  size_t size_;
+  size_t pos_;
+};
+
+}  // namespace ltl
+
+#endif  // LTL_BINARY_IO_H_
@@ -0,0 +1,330 @@
+// Copyright (c) 2020 Klemens Esterle, Luis Gressenbuch
+//
+// This work is licensed under the terms of the MIT license.
+// For a copy, see <https://opensource.org/licenses/MIT>.
+
+#include "ltl/compiled_automaton.h"
+
+#include <algorithm>
+#include <cstring>
+#include <functional>
+#include <mutex>
+#if defined(__BMI2__)
+#include <immintrin.h>
+#endif
+
+#include "glog/logging.h"
+#include "ltl/binary_io.h"
+
+namespace ltl {
+
+CompiledAutomaton::CompiledAutomaton(const spot::twa_graph_ptr& aut)
+    : init_state_(aut->get_init_state_number()) {
+  CHECK_LE(aut->ap().size(), kMaxAPs) << "Too many APs in rule automaton";
+  // Map BDD variables to the dense AP index
+  std::vector<int> var_to_ap_idx;
+  for (const auto& ap : aut->ap()) {
+    const int var = aut->get_dict()->has_registered_proposition(ap, aut);
+    CHECK_GE(var, 0);
+    if (static_cast<size_t>(var) >= var_to_ap_idx.size()) {
+      var_to_ap_idx.resize(var + 1, -1);
+    }
+    var_to_ap_idx[var] = static_cast<int>(aps_.size());
+    aps_.push_back(ap.ap_name());
+  }
+
+  auto tables = std::make_shared<Tables>();
+  const size_t num_states = aut->num_states();
+  tables->state_edges.reserve(num_states + 1);
+  tables->accepting.reserve(num_states);
+  for (size_t s = 0; s < num_states; ++s) {
+    tables->state_edges.push_back(tables->edges.size());
+    tables->accepting.push_back(aut->state_is_accepting(s));
+    for (const auto& transition : aut->out(s)) {
+      Edge edge;
+      edge.dst = transition.dst;
+      edge.cube_begin = tables->cubes.size();
+      edge.num_true_cubes =
+          CompileGuard(transition.cond, var_to_ap_idx, &tables->cubes);
+      edge.num_false_cubes =
+          tables->cubes.size() - edge.cube_begin - edge.num_true_cubes;
+      tables->edges.push_back(edge);
+    }
+  }
+  tables->state_edges.push_back(tables->edges.size());
+  SetTables(tables);
+  ComputeSupport();
+  BuildLookup();
+}
+
+void CompiledAutomaton::ComputeSupport() {
+  support_.assign(num_states_, 0);
+  for (size_t s = 0; s < num_states_; ++s) {
+    for (uint32_t e = state_edges_[s]; e < state_edges_[s + 1]; ++e) {
+      const Edge& edge = edges_[e];
+      const Cube* cube = cubes_ + edge.cube_begin;
+      const Cube* const end =
+          cube + edge.num_true_cubes + edge.num_false_cubes;
+      for (; cube != end; ++cube) {
+        support_[s] |= cube->care;
+      }
+    }
+  }
+}
+
+void CompiledAutomaton::BuildLookup() {
+  lookup_.assign(num_states_, StateLookup());
+  lookup_table_.clear();
+  for (uint32_t s = 0; s < num_states_; ++s) {
+    StateLookup& lookup = lookup_[s];
+    lookup.table_begin = lookup_table_.size();
+    lookup.num_bits = __builtin_popcountll(support_[s]);
+    if (lookup.num_bits > kMaxLookupBits) {
+      continue;
+    }
+    uint32_t b = 0;
+    for (size_t ap = 0; ap < kMaxAPs; ++ap) {
+      if ((support_[s] >> ap) & 1) {
+        lookup.bits[b++] = ap;
+      }
+    }
+    for (uint32_t idx = 0; idx < (uint32_t(1) << lookup.num_bits); ++idx) {
+      APMask values = 0;
+      for (b = 0; b < lookup.num_bits; ++b) {
+        values |= APMask((idx >> b) & 1) << lookup.bits[b];
+      }
+      uint32_t next;
+      const StepResult result = Search(s, support_[s], values, &next);
+      // All guards only depend on known APs
+      CHECK_NE(result, UNDEF) << "Undefined step in state " << s;
+      lookup_table_.push_back(result == TRUE ? next : kNoTransition);
+    }
+  }
+}
+
+void CompiledAutomaton::SetTables(std::shared_ptr<const Tables> tables) {
+  state_edges_ = tables->state_edges.data();
+  edges_ = tables->edges.data();
+  cubes_ = tables->cubes.data();
+  accepting_ = tables->accepting.data();
+  num_states_ = tables->accepting.size();
+  num_edges_ = tables->edges.size();
+  num_cubes_ = tables->cubes.size();
+  storage_ = tables;
+}
+
+uint32_t CompiledAutomaton::CompileGuard(const bdd& cond,
+                                         const std::vector<int>& var_to_ap_idx,
+                                         std::vector<Cube>* cubes) {
+  const size_t cube_begin = cubes->size();
+  std::vector<Cube> false_cubes;
+  // Every path from the root to a terminal is one cube
+  std::function<void(const bdd&, APMask, APMask)> walk =
+      [&](const bdd& node, APMask care, APMask value) {
+        if (node == bddtrue) {
+          cubes->push_back({care, value});
+        } else if (node == bddfalse) {
+          false_cubes.push_back({care, value});
+        } else {
+          const int var = bdd_var(node);
+          CHECK(var < static_cast<int>(var_to_ap_idx.size()) &&
+                var_to_ap_idx[var] >= 0)
+              << "Guard depends on unregistered BDD variable " << var;
+          const APMask bit = APMask(1) << var_to_ap_idx[var];
+          walk(bdd_low(node), care | bit, value);
+          walk(bdd_high(node), care | bit, value | bit);
+        }
+      };
+  walk(cond, 0, 0);
+  const uint32_t num_true_cubes = cubes->size() - cube_begin;
+  cubes->insert(cubes->end(), false_cubes.begin(), false_cubes.end());
+  return num_true_cubes;
+}
+
+CompiledAutomaton::StepResult CompiledAutomaton::EvaluateEdge(
+    const Edge& edge, const Cube* cubes, APMask known, APMask values) {
+  const Cube* cube = cubes + edge.cube_begin;
+  const Cube* const false_begin = cube + edge.num_true_cubes;
+  const Cube* const end = false_begin + edge.num_false_cubes;
+  for (; cube != end; ++cube) {
+    if ((cube->care & ~known) == 0 &&
+        ((values ^ cube->value) & cube->care) == 0) {
+      return cube < false_begin ? TRUE : FALSE;
+    }
+  }
+  // Some AP along the path selected by the known APs is undefined
+  return UNDEF;
+}
+
+CompiledAutomaton::StepResult CompiledAutomaton::Search(uint32_t state,
+                                                        APMask known,
+                                                        APMask values,
+                                                        uint32_t* next) const {
+  bool undef_trans_found = false;
+  const Edge* edge = edges_ + state_edges_[state];
+  const Edge* const end = edges_ + state_edges_[state + 1];
+  for (; edge != end; ++edge) {
+    const StepResult result = EvaluateEdge(*edge, cubes_, known, values);
+    if (result == TRUE) {
+      *next = edge->dst;
+      return TRUE;
+    }
+    if (result == UNDEF) {
+      undef_trans_found = true;
+    }
+  }
+  return undef_trans_found ? UNDEF : FALSE;
+}
+
+CompiledAutomaton::StepResult CompiledAutomaton::Lookup(uint32_t state,
+                                                        APMask values,
+                                                        uint32_t* next) const {
+  const StateLookup& lookup = lookup_[state];
+  uint32_t dst;
+  if (lookup.num_bits <= kMaxLookupBits) {
+#if defined(__BMI2__)
+    const uint32_t idx = _pext_u64(values, support_[state]);
+#else
+    uint32_t idx = 0;
+    for (uint32_t b = 0; b < lookup.num_bits; ++b) {
+      idx |= ((values >> lookup.bits[b]) & 1) << b;
+    }
+#endif
+    dst = lookup_table_[lookup.table_begin + idx];
+  } else {
+    dst = LookupCache(state, values & support_[state]);
+  }
+  if (dst == kNoTransition) {
+    return FALSE;
+  }
+  *next = dst;
+  return TRUE;
+}
+
+uint32_t CompiledAutomaton::LookupCache(uint32_t state,
+                                        APMask support_values) const {
+  const CacheKey key{state, support_values};
+  {
+    std::shared_lock<std::shared_mutex> lock(cache_mutex_);
+    auto it = cache_.find(key);
+    if (it != cache_.end()) {
+      return it->second;
+    }
+  }
+  uint32_t dst;
+  if (Search(state, support_[state], support_values, &dst) != TRUE) {
+    dst = kNoTransition;
+  }
+  if (cache_full_.load(std::memory_order_relaxed)) {
+    return dst;
+  }
+  std::unique_lock<std::shared_mutex> lock(cache_mutex_);
+  if (cache_.size() < kMaxCachedSteps) {
+    cache_.emplace(key, dst);
+  }
+  if (cache_.size() >= kMaxCachedSteps) {
+    cache_full_.store(true, std::memory_order_relaxed);
+  }
+  return dst;
+}
+
+bool CompiledAutomaton::IsStable(uint32_t state, APMask known,
+                                 APMask values) const {
+  const Edge* edge = edges_ + state_edges_[state];
+  const Edge* const end = edges_ + state_edges_[state + 1];
+  for (; edge != end; ++edge) {
+    switch (EvaluateEdge(*edge, cubes_, known, values)) {
+      case TRUE:
+        return edge->dst == state;
+      case UNDEF:
+        // Taken by some completion of the valuation
+        if (edge->dst != state) {
+          return false;
+        }
+        break;
+      case FALSE:
+        break;
+    }
+  }
+  // Some completion of the valuation has no transition
+  return false;
+}
+
+void CompiledAutomaton::Serialize(BinaryWriter* writer) const {
+  writer->Write(aps_);
+  writer->Write(init_state_);
+  writer->WriteAligned(
+      std::vector<uint32_t>(state_edges_, state_edges_ + num_states_ + 1));
+  writer->WriteAligned(std::vector<Edge>(edges_, edges_ + num_edges_));
+  writer->WriteAligned(std::vector<Cube>(cubes_, cubes_ + num_cubes_));
+  writer->WriteAligned(
+      std::vector<uint8_t>(accepting_, accepting_ + num_states_));
+}
+
+std::shared_ptr<const CompiledAutomaton> CompiledAutomaton::Deserialize(
+    BinaryReader* reader, const std::shared_ptr<const void>& storage) {
+  std::shared_ptr<CompiledAutomaton> compiled(new CompiledAutomaton());
+  compiled->aps_ = reader->ReadStringVector();
+  compiled->init_state_ = reader->Read<uint32_t>();
+  uint64_t num_state_edges, num_edges, num_cubes, num_accepting;
+  compiled->state_edges_ = reader->ReadAlignedArray<uint32_t>(&num_state_edges);
+  compiled->edges_ = reader->ReadAlignedArray<Edge>(&num_edges);
+  compiled->cubes_ = reader->ReadAlignedArray<Cube>(&num_cubes);
+  compiled->accepting_ = reader->ReadAlignedArray<uint8_t>(&num_accepting);
+  compiled->num_states_ = num_accepting;
+  compiled->num_edges_ = num_edges;
+  compiled->num_cubes_ = num_cubes;
+
+  const bool aligned = BinaryReader::IsAligned(compiled->state_edges_) &&
+                       BinaryReader::IsAligned(compiled->edges_) &&
+                       BinaryReader::IsAligned(compiled->cubes_);
+  if (storage && aligned) {
+    compiled->storage_ = storage;
+  } else {
+    auto tables = std::make_shared<Tables>();
+    tables->state_edges.resize(num_state_edges);
+    std::memcpy(tables->state_edges.data(), compiled->state_edges_,
+                num_state_edges * sizeof(uint32_t));
+    tables->edges.resize(compiled->num_edges_);
+    std::memcpy(tables->edges.data(), compiled->edges_,
+                compiled->num_edges_ * sizeof(Edge));
+    tables->cubes.resize(compiled->num_cubes_);
+    std::memcpy(tables->cubes.data(), compiled->cubes_,
+                compiled->num_cubes_ * sizeof(Cube));
+    tables->accepting.assign(compiled->accepting_,
+                             compiled->accepting_ + num_accepting);
+    compiled->SetTables(tables);
+  }
+
+  // Validate, so corrupt data cannot cause out of bounds accesses later on
+  const size_t num_states = compiled->num_states_;
+  const uint32_t* state_edges = compiled->state_edges_;
+  CheckData(compiled->aps_.size() <= kMaxAPs);
+  CheckData(num_states > 0 && compiled->init_state_ < num_states &&
+            num_state_edges == num_states + 1 && state_edges[0] == 0 &&
+            state_edges[num_states] == compiled->num_edges_ &&
+            std::is_sorted(state_edges, state_edges + num_states + 1));
+  for (size_t e = 0; e < compiled->num_edges_; ++e) {
+    const Edge& edge = compiled->edges_[e];
+    CheckData(edge.dst < num_states &&
+              static_cast<uint64_t>(edge.cube_begin) + edge.num_true_cubes +
+                      edge.num_false_cubes <=
+                  compiled->num_cubes_);
+  }
+  compiled->ComputeSupport();
+  compiled->BuildLookup();
+  return compiled;
+}
+
+int CompiledAutomaton::GetAPIndex(const std::string& ap_name) const {
+  auto it = std::find(aps_.begin(), aps_.end(), ap_name);
+  return it != aps_.end() ? static_cast<int>(it - aps_.begin()) : -1;
+}
+size_t CompiledAutomaton::GetNumAPs() const { return aps_.size(); }
+uint32_t CompiledAutomaton::GetInitState() const { return init_state_; }
+size_t CompiledAutomaton::GetNumStates() const { return num_states_; }
+bool CompiledAutomaton::IsAccepting(uint32_t state) const {
+  return accepting_[state];
+}
+
+}  // namespace ltl
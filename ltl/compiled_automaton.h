@@ -0,0 +1,176 @@
+// Copyright (c) 2020 Klemens Esterle, Luis Gressenbuch
+//
+// This work is licensed under the terms of the MIT license.
+// For a copy, see <https://opensource.org/licenses/MIT>.
+
+#ifndef LTL_COMPILED_AUTOMATON_H_
+#define LTL_COMPILED_AUTOMATON_H_
+
+#include <atomic>
+#include <cstdint>
+#include <memory>
+#include <shared_mutex>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+#include "spot/twa/twagraph.hh"
+
+namespace ltl {
+
+class BinaryReader;
+class BinaryWriter;
+
+/// Flat, BDD-free representation of a (deterministic) rule automaton.
+///
+/// The edges of every state are stored contiguously and their guards are
+/// lowered to cubes over a dense AP index. A cube is a pair of bit masks
+/// (care, value): it matches a valuation if all cared-for APs are known and
+/// have the given value. Every BDD path of a guard becomes one cube, paths to
+/// bddtrue first, followed by paths to bddfalse. Therefore, evaluating an edge
+/// on a partial valuation yields the same result as walking its BDD.
+///
+/// Steps on valuations which know the whole support of a state are memoised.
+/// States with up to kMaxLookupBits support APs get a lookup table indexed by
+/// the valuation of their support, larger ones fill a cache on demand. Once
+/// the cache holds kMaxCachedSteps steps, further misses search the edges.
+class CompiledAutomaton {
+ public:
+  typedef uint64_t APMask;
+  static constexpr size_t kMaxAPs = 64;
+  static constexpr size_t kMaxLookupBits = 10;
+  static constexpr size_t kMaxCachedSteps = 1 << 16;
+
+  enum StepResult { TRUE, FALSE, UNDEF };
+
+  struct Cube {
+    APMask care;
+    APMask value;
+  };
+
+  struct Edge {
+    uint32_t dst;
+    uint32_t cube_begin;
+    uint32_t num_true_cubes;
+    uint32_t num_false_cubes;
+  };
+
+  explicit CompiledAutomaton(const spot::twa_graph_ptr& aut);
+
+  void Serialize(BinaryWriter* writer) const;
+  /// Restores an automaton written by Serialize, without invoking Spot.
+  /// \param storage If set, the transition tables are not copied but used in
+  /// place. storage has to keep the buffer of reader alive.
+  /// The supports and lookup tables are not serialized. They are rebuilt by
+  /// every Deserialize and owned by the process, also if the transition
+  /// tables are shared.
+  static std::shared_ptr<const CompiledAutomaton> Deserialize(
+      BinaryReader* reader,
+      const std::shared_ptr<const void>& storage = nullptr);
+
+  /// Take the first edge of state whose guard is satisfied.
+  /// \param state Current automaton state
+  /// \param known Mask of APs with a defined value
+  /// \param values Values of the APs, only bits in known are considered
+  /// \param next Destination of the edge taken, only set on TRUE
+  /// \return TRUE if an edge was taken, UNDEF if no edge was taken but
+  /// at least one guard depends on an unknown AP, FALSE otherwise
+  StepResult Step(uint32_t state, APMask known, APMask values,
+                  uint32_t* next) const {
+    if ((support_[state] & ~known) == 0) {
+      return Lookup(state, values, next);
+    }
+    return Search(state, known, values, next);
+  }
+
+  /// True if no valuation which agrees with the partial valuation
+  /// (known, values) leaves state, i.e. every such step is TRUE and loops.
+  bool IsStable(uint32_t state, APMask known, APMask values) const;
+
+  /// APs the guards of the edges leaving state depend on. Steps from state
+  /// on valuations which only differ outside the support have equal results.
+  APMask GetSupport(uint32_t state) const { return support_[state]; }
+
+  /// Dense index of an AP, -1 if the automaton does not use it.
+  int GetAPIndex(const std::string& ap_name) const;
+  size_t GetNumAPs() const;
+  uint32_t GetInitState() const;
+  size_t GetNumStates() const;
+  bool IsAccepting(uint32_t state) const;
+
+ private:
+  struct Tables {
+    std::vector<uint32_t> state_edges;
+    std::vector<Edge> edges;
+    std::vector<Cube> cubes;
+    std::vector<uint8_t> accepting;
+  };
+
+  static constexpr uint32_t kNoTransition = ~uint32_t(0);
+
+  // Lookup of the steps from one state
+  struct StateLookup {
+    // Offset into lookup_table_, unused if num_bits > kMaxLookupBits
+    uint32_t table_begin;
+    uint32_t num_bits;
+    // Support APs in ascending order, bit b of the table index is AP bits[b]
+    uint8_t bits[kMaxLookupBits];
+  };
+
+  struct CacheKey {
+    bool operator==(const CacheKey& rhs) const {
+      return state == rhs.state && values == rhs.values;
+    }
+    uint32_t state;
+    APMask values;
+  };
+  struct CacheKeyHash {
+    size_t operator()(const CacheKey& key) const {
+      return std::hash<APMask>()(key.values * 31 + key.state);
+    }
+  };
+
+  CompiledAutomaton() = default;
+  static uint32_t CompileGuard(const bdd& cond,
+                               const std::vector<int>& var_to_ap_idx,
+                               std::vector<Cube>* cubes);
+  static StepResult EvaluateEdge(const Edge& edge, const Cube* cubes,
+                                 APMask known, APMask values);
+  void SetTables(std::shared_ptr<const Tables> tables);
+  void ComputeSupport();
+  void BuildLookup();
+  /// Step by walking the edges of state.
+  StepResult Search(uint32_t state, APMask known, APMask values,
+                    uint32_t* next) const;
+  /// Step on a valuation which knows the support of state.
+  StepResult Lookup(uint32_t state, APMask values, uint32_t* next) const;
+  /// Destination from state on a support valuation, filling the cache.
+  uint32_t LookupCache(uint32_t state, APMask support_values) const;
+
+  std::vector<std::string> aps_;
+  uint32_t init_state_;
+  // Transition tables, either owned or in a shared buffer. Edges of state s
+  // are edges_[state_edges_[s]] to edges_[state_edges_[s + 1] - 1].
+  const uint32_t* state_edges_;
+  const Edge* edges_;
+  const Cube* cubes_;
+  const uint8_t* accepting_;
+  size_t num_states_;
+  size_t num_edges_;
+  size_t num_cubes_;
+  // Keeps the memory of the tables alive
+  std::shared_ptr<const void> storage_;
+  std::vector<APMask> support_;
+  std::vector<StateLookup> lookup_;
+  // Destination per support valuation, kNoTransition if no edge matches
+  std::vector<uint32_t> lookup_table_;
+  // Steps from states with large supports, keyed by the support valuation
+  mutable std::shared_mutex cache_mutex_;
+  mutable std::unordered_map<CacheKey, uint32_t, CacheKeyHash> cache_;
+  // Set once cache_ holds kMaxCachedSteps, so misses skip the exclusive lock
+  mutable std::atomic<bool> cache_full_{false};
+};
+
+}  // namespace ltl
+
+#endif  // LTL_COMPILED_AUTOMATON_H_
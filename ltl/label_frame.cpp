@@ -0,0 +1,257 @@
+// Copyright (c) 2020 Klemens Esterle, Luis Gressenbuch
+//
+// This work is licensed under the terms of the MIT license.
+// For a copy, see <https://opensource.org/licenses/MIT>.
+
+#include "ltl/label_frame.h"
+
+#include <algorithm>
+#include <stdexcept>
+
+#include "glog/logging.h"
+
+namespace ltl {
+
+namespace {
+// Word w of PackBits
+uint64_t PackWord(const uint8_t* bytes, size_t num_slots, size_t w) {
+  const size_t end = std::min(num_slots, (w + 1) * 64);
+  uint64_t word = 0;
+  for (size_t i = w * 64; i < end; ++i) {
+    word |= uint64_t(!bytes || bytes[i] != 0) << (i % 64);
+  }
+  return word;
+}
+
+// Bit i of words is set if bytes[i] is non-zero, all bits if bytes is nullptr
+void PackBits(const uint8_t* bytes, size_t num_slots, uint64_t* words) {
+  for (size_t w = 0; w * 64 < num_slots; ++w) {
+    words[w] = PackWord(bytes, num_slots, w);
+  }
+}
+}  // namespace
+
+int LabelRegistry::Register(const Label& label) {
+  auto it = slots_.find(label);
+  if (it != slots_.end()) {
+    return it->second;
+  }
+  if (label.IsAgentSpecific()) {
+    return Register(RegisterAgentLabel(label.GetLabelStr()),
+                    RegisterAgent(label.GetAgentId()));
+  }
+  const int slot = static_cast<int>(labels_.size());
+  slots_.insert({label, slot});
+  labels_.push_back(label);
+  return slot;
+}
+int LabelRegistry::GetSlot(const Label& label) const {
+  auto it = slots_.find(label);
+  return it != slots_.end() ? it->second : -1;
+}
+const Label& LabelRegistry::GetLabel(int slot) const {
+  return labels_.at(slot);
+}
+size_t LabelRegistry::GetNumSlots() const { return labels_.size(); }
+
+int LabelRegistry::RegisterAgent(int agent_id) {
+  auto inserted = agent_indices_.insert(
+      {agent_id, static_cast<int>(agent_ids_.size())});
+  if (inserted.second) {
+    agent_ids_.push_back(agent_id);
+  }
+  return inserted.first->second;
+}
+int LabelRegistry::GetAgentIndex(int agent_id) const {
+  auto it = agent_indices_.find(agent_id);
+  return it != agent_indices_.end() ? it->second : -1;
+}
+int LabelRegistry::GetAgentId(int agent_idx) const {
+  return agent_ids_.at(agent_idx);
+}
+size_t LabelRegistry::GetNumAgents() const { return agent_ids_.size(); }
+
+int LabelRegistry::RegisterAgentLabel(const std::string& name) {
+  auto inserted = agent_label_indices_.insert(
+      {name, static_cast<int>(agent_slots_.size())});
+  if (inserted.second) {
+    agent_label_names_.push_back(name);
+    agent_slots_.emplace_back();
+  }
+  return inserted.first->second;
+}
+int LabelRegistry::GetAgentLabelIndex(const std::string& name) const {
+  auto it = agent_label_indices_.find(name);
+  return it != agent_label_indices_.end() ? it->second : -1;
+}
+
+int LabelRegistry::Register(int name_idx, int agent_idx) {
+  if (static_cast<size_t>(name_idx) >= agent_slots_.size() ||
+      static_cast<size_t>(agent_idx) >= agent_ids_.size()) {
+    throw std::out_of_range("Unregistered agent label " +
+                            std::to_string(name_idx) + " or agent " +
+                            std::to_string(agent_idx));
+  }
+  std::vector<int>& slots = agent_slots_[name_idx];
+  if (static_cast<size_t>(agent_idx) >= slots.size()) {
+    slots.resize(agent_ids_.size(), -1);
+  }
+  if (slots[agent_idx] < 0) {
+    const Label label(agent_label_names_[name_idx], agent_ids_[agent_idx]);
+    slots[agent_idx] = static_cast<int>(labels_.size());
+    slots_.insert({label, slots[agent_idx]});
+    labels_.push_back(label);
+  }
+  return slots[agent_idx];
+}
+
+LabelFrame::LabelFrame(size_t num_slots) : num_slots_(0) { Resize(num_slots); }
+LabelFrame::LabelFrame(const LabelRegistry& registry)
+    : LabelFrame(registry.GetNumSlots()) {}
+
+LabelFrame LabelFrame::FromEvaluationMap(const LabelRegistry& registry,
+                                         const EvaluationMap& labels) {
+  LabelFrame frame(registry);
+  for (const auto& label : labels) {
+    const int slot = registry.GetSlot(label.first);
+    if (slot >= 0) {
+      frame.Set(slot, label.second);
+    }
+  }
+  return frame;
+}
+
+void LabelFrame::Resize(size_t num_slots) {
+  num_slots_ = num_slots;
+  defined_.resize((num_slots + 63) / 64, 0);
+  values_.resize(defined_.size(), 0);
+  changed_.resize(defined_.size(), 0);
+  if (num_slots % 64 != 0) {
+    // Drop stale bits when shrinking
+    const uint64_t mask = (uint64_t(1) << (num_slots % 64)) - 1;
+    defined_.back() &= mask;
+    values_.back() &= mask;
+    changed_.back() &= mask;
+  }
+}
+void LabelFrame::Clear() {
+  for (size_t w = 0; w < defined_.size(); ++w) {
+    changed_[w] |= defined_[w];
+  }
+  std::fill(defined_.begin(), defined_.end(), 0);
+  std::fill(values_.begin(), values_.end(), 0);
+}
+void LabelFrame::Set(int slot, bool value) {
+  DCHECK_LT(static_cast<size_t>(slot), num_slots_);
+  const uint64_t bit = uint64_t(1) << (slot % 64);
+  const size_t w = slot / 64;
+  const uint64_t new_value = value ? bit : 0;
+  if (!(defined_[w] & bit) || (values_[w] & bit) != new_value) {
+    changed_[w] |= bit;
+  }
+  defined_[w] |= bit;
+  values_[w] = (values_[w] & ~bit) | new_value;
+}
+void LabelFrame::Unset(int slot) {
+  DCHECK_LT(static_cast<size_t>(slot), num_slots_);
+  const uint64_t bit = uint64_t(1) << (slot % 64);
+  changed_[slot / 64] |= defined_[slot / 64] & bit;
+  defined_[slot / 64] &= ~bit;
+  values_[slot / 64] &= ~bit;
+}
+void LabelFrame::Assign(const uint8_t* values, const uint8_t* defined) {
+  for (size_t w = 0; w < values_.size(); ++w) {
+    const uint64_t word_defined = PackWord(defined, num_slots_, w);
+    const uint64_t word_values = PackWord(values, num_slots_, w) & word_defined;
+    changed_[w] |= (defined_[w] ^ word_defined) | (values_[w] ^ word_values);
+    defined_[w] = word_defined;
+    values_[w] = word_values;
+  }
+}
+
+void LabelFrame::ClearChanges() {
+  std::fill(changed_.begin(), changed_.end(), 0);
+}
+void LabelFrame::MarkChanges(const LabelFrame& previous) {
+  CHECK_EQ(previous.num_slots_, num_slots_) << "Frames differ in size!";
+  for (size_t w = 0; w < changed_.size(); ++w) {
+    changed_[w] |= (defined_[w] ^ previous.defined_[w]) |
+                   (values_[w] ^ previous.values_[w]);
+  }
+}
+void LabelFrame::MarkAllChanged() {
+  std::fill(changed_.begin(), changed_.end(), ~uint64_t(0));
+  Resize(num_slots_);
+}
+
+LabelTrace::LabelTrace(size_t num_steps, size_t num_slots)
+    : num_steps_(num_steps),
+      num_slots_(num_slots),
+      num_words_((num_slots + 63) / 64),
+      defined_(num_steps * num_words_, 0),
+      values_(num_steps * num_words_, 0) {}
+LabelTrace::LabelTrace(size_t num_steps, const LabelRegistry& registry)
+    : LabelTrace(num_steps, registry.GetNumSlots()) {}
+
+void LabelTrace::Set(size_t step, int slot, bool value) {
+  DCHECK_LT(step, num_steps_);
+  DCHECK_LT(static_cast<size_t>(slot), num_slots_);
+  const size_t word = step * num_words_ + slot / 64;
+  const uint64_t bit = uint64_t(1) << (slot % 64);
+  defined_[word] |= bit;
+  if (value) {
+    values_[word] |= bit;
+  } else {
+    values_[word] &= ~bit;
+  }
+}
+
+void LabelTrace::SetFrame(size_t step, const LabelFrame& frame) {
+  CHECK_LT(step, num_steps_);
+  CHECK_EQ(frame.GetNumSlots(), num_slots_) << "Frame has wrong size!";
+  std::copy(frame.defined_.begin(), frame.defined_.end(),
+            defined_.begin() + step * num_words_);
+  std::copy(frame.values_.begin(), frame.values_.end(),
+            values_.begin() + step * num_words_);
+}
+
+void LabelTrace::Assign(const uint8_t* values, const uint8_t* defined) {
+  for (size_t t = 0; t < num_steps_; ++t) {
+    uint64_t* step_values = &values_[t * num_words_];
+    uint64_t* step_defined = &defined_[t * num_words_];
+    PackBits(values + t * num_slots_, num_slots_, step_values);
+    PackBits(defined ? defined + t * num_slots_ : nullptr, num_slots_,
+             step_defined);
+    for (size_t w = 0; w < num_words_; ++w) {
+      step_values[w] &= step_defined[w];
+    }
+  }
+}
+
+void LabelTrace::GetFrame(size_t step, LabelFrame* frame) const {
+  CHECK_LT(step, num_steps_);
+  if (frame->GetNumSlots() != num_slots_) {
+    frame->Resize(num_slots_);
+  }
+  for (size_t w = 0; w < num_words_; ++w) {
+    const uint64_t defined = defined_[step * num_words_ + w];
+    const uint64_t values = values_[step * num_words_ + w];
+    frame->changed_[w] |=
+        (frame->defined_[w] ^ defined) | (frame->values_[w] ^ values);
+    frame->defined_[w] = defined;
+    frame->values_[w] = values;
+  }
+}
+
+bool LabelTrace::IsDefined(size_t step, int slot) const {
+  return step < num_steps_ && slot >= 0 &&
+         static_cast<size_t>(slot) < num_slots_ &&
+         ((defined_[step * num_words_ + slot / 64] >> (slot % 64)) & 1);
+}
+bool LabelTrace::Get(size_t step, int slot) const {
+  return (values_[step * num_words_ + slot / 64] >> (slot % 64)) & 1;
+}
+size_t LabelTrace::GetNumSteps() const { return num_steps_; }
+size_t LabelTrace::GetNumSlots() const { return num_slots_; }
+
+}  // namespace ltl
@@ -0,0 +1,157 @@
+// Copyright (c) 2020 Klemens Esterle, Luis Gressenbuch
+//
+// This work is licensed under the terms of the MIT license.
+// For a copy, see <https://opensource.org/licenses/MIT>.
+
+#ifndef LTL_LABEL_FRAME_H_
+#define LTL_LABEL_FRAME_H_
+
+#include <cstdint>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+#include "bark/world/evaluation/ltl/label/label.h"
+
+namespace ltl {
+using bark::world::evaluation::EvaluationMap;
+using bark::world::evaluation::Label;
+
+/// Universe of labels known to a caller. Every registered label is assigned a
+/// dense, stable slot id.
+///
+/// Agent ids and the names of agent specific labels are interned to dense
+/// indices. The slots of agent specific labels form a table of names x agent
+/// indices, so label producers and rule states look them up by indexing
+/// instead of hashing labels.
+class LabelRegistry {
+ public:
+  /// Returns the slot of label, registering it if necessary.
+  int Register(const Label& label);
+  /// Returns the slot of label or -1 if it has not been registered.
+  int GetSlot(const Label& label) const;
+  const Label& GetLabel(int slot) const;
+  size_t GetNumSlots() const;
+
+  /// Returns the dense index of agent_id, registering it if necessary.
+  int RegisterAgent(int agent_id);
+  /// Returns the index of agent_id or -1 if it has not been registered.
+  int GetAgentIndex(int agent_id) const;
+  int GetAgentId(int agent_idx) const;
+  size_t GetNumAgents() const;
+
+  /// Returns the dense index of an agent specific label name, registering it
+  /// if necessary.
+  int RegisterAgentLabel(const std::string& name);
+  /// Returns the index of name or -1 if it has not been registered.
+  int GetAgentLabelIndex(const std::string& name) const;
+
+  /// Returns the slot of the agent specific label name_idx of the agent
+  /// agent_idx, registering it if necessary. Throws std::out_of_range if
+  /// name_idx or agent_idx have not been registered.
+  int Register(int name_idx, int agent_idx);
+  /// Returns the slot of the agent specific label name_idx of the agent
+  /// agent_idx or -1 if it has not been registered.
+  int GetSlot(int name_idx, int agent_idx) const {
+    if (static_cast<size_t>(name_idx) >= agent_slots_.size()) {
+      return -1;
+    }
+    const std::vector<int>& slots = agent_slots_[name_idx];
+    return static_cast<size_t>(agent_idx) < slots.size() ? slots[agent_idx]
+                                                         : -1;
+  }
+
+ private:
+  std::unordered_map<Label, int, EvaluationMap::hasher> slots_;
+  std::vector<Label> labels_;
+  std::unordered_map<int, int> agent_indices_;
+  std::vector<int> agent_ids_;
+  std::unordered_map<std::string, int> agent_label_indices_;
+  std::vector<std::string> agent_label_names_;
+  // Slots per agent specific label name and agent index, -1 if unregistered
+  std::vector<std::vector<int>> agent_slots_;
+};
+
+/// Dense label valuation indexed by the slots of a LabelRegistry. Slots that
+/// have not been set are undefined.
+///
+/// The frame records which slots changed their value or definedness, see
+/// RuleStateSet::EvaluateDelta. A caller reusing one frame only sets the
+/// labels that changed and calls ClearChanges after each step.
+class LabelFrame {
+ public:
+  explicit LabelFrame(size_t num_slots = 0);
+  explicit LabelFrame(const LabelRegistry& registry);
+
+  /// Creates a frame containing all labels of the map which are registered.
+  static LabelFrame FromEvaluationMap(const LabelRegistry& registry,
+                                      const EvaluationMap& labels);
+
+  void Resize(size_t num_slots);
+  void Clear();
+  void Set(int slot, bool value);
+  void Unset(int slot);
+  /// Set all slots from byte arrays with GetNumSlots() entries.
+  /// \param defined Slots that are defined, nullptr if all are
+  void Assign(const uint8_t* values, const uint8_t* defined = nullptr);
+
+  bool HasChanged(int slot) const {
+    return (changed_[slot / 64] >> (slot % 64)) & 1;
+  }
+  void ClearChanges();
+  /// Mark all slots differing from previous as changed, for callers building
+  /// a new frame per step.
+  void MarkChanges(const LabelFrame& previous);
+  void MarkAllChanged();
+
+  bool IsDefined(int slot) const {
+    return slot >= 0 && static_cast<size_t>(slot) < num_slots_ &&
+           ((defined_[slot / 64] >> (slot % 64)) & 1);
+  }
+  bool Get(int slot) const { return (values_[slot / 64] >> (slot % 64)) & 1; }
+  size_t GetNumSlots() const { return num_slots_; }
+
+ private:
+  friend class LabelTrace;
+
+  size_t num_slots_;
+  std::vector<uint64_t> defined_;
+  std::vector<uint64_t> values_;
+  std::vector<uint64_t> changed_;
+};
+
+/// Sequence of label frames stored as one bit matrix of
+/// timesteps x label slots, e.g. a recorded scenario.
+class LabelTrace {
+ public:
+  LabelTrace(size_t num_steps, size_t num_slots);
+  explicit LabelTrace(size_t num_steps, const LabelRegistry& registry);
+
+  void Set(size_t step, int slot, bool value);
+  void SetFrame(size_t step, const LabelFrame& frame);
+  /// Set all steps from row-major byte matrices of
+  /// GetNumSteps() x GetNumSlots() entries.
+  /// \param defined Slots that are defined, nullptr if all are
+  void Assign(const uint8_t* values, const uint8_t* defined = nullptr);
+
+  /// Copy one timestep into frame, which is resized if necessary. Slots
+  /// differing from the previous content of frame are marked as changed.
+  void GetFrame(size_t step, LabelFrame* frame) const;
+
+  bool IsDefined(size_t step, int slot) const;
+  bool Get(size_t step, int slot) const;
+  size_t GetNumSteps() const;
+  size_t GetNumSlots() const;
+
+ private:
+  size_t num_steps_;
+  size_t num_slots_;
+  // Words per timestep
+  size_t num_words_;
+  std::vector<uint64_t> defined_;
+  std::vector<uint64_t> values_;
+};
+
+}  // namespace ltl
+
+#endif  // LTL_LABEL_FRAME_H_
@@ -0,0 +1,243 @@
+// Copyright (c) 2020 Klemens Esterle, Luis Gressenbuch
+//
+// This work is licensed under the terms of the MIT license.
+// For a copy, see <https://opensource.org/licenses/MIT>.
+
+#include "ltl/product_monitor.h"
+
+#include <algorithm>
+#include <functional>
+
+#include "glog/logging.h"
+
+namespace ltl {
+
+ProductMonitor::ProductMonitor(
+    const std::vector<RuleMonitor::RuleMonitorSPtr>& rules)
+    : rules_(rules), alive_bit_(1), all_bits_(1) {
+  CHECK_LE(rules_.size(), kMaxRules) << "Too many rules in product!";
+  // Bit 0 is alive, the labels follow
+  std::vector<std::string> ap_names;
+  for (const auto& rule : rules_) {
+    CHECK(!rule->IsAgentSpecific())
+        << "Rule " << rule->GetStrFormula()
+        << " is agent specific and cannot be part of a product!";
+    std::vector<APProjection> projection;
+    projection.push_back({alive_bit_, rule->alive_mask_});
+    for (const auto& binding : rule->label_bindings_) {
+      const std::string& name = rule->ap_alphabet_[binding.ap_idx].ap_str;
+      auto it = std::find(ap_names.begin(), ap_names.end(), name);
+      if (it == ap_names.end()) {
+        CHECK_LT(ap_names.size() + 1, CompiledAutomaton::kMaxAPs)
+            << "Too many labels in product!";
+        it = ap_names.insert(ap_names.end(), name);
+        labels_.push_back(Label(name));
+      }
+      projection.push_back(
+          {APMask(1) << (it - ap_names.begin() + 1), binding.bit});
+    }
+    projections_.push_back(projection);
+  }
+  all_bits_ = (APMask(1) << (labels_.size() + 1)) - 1;
+  std::vector<uint32_t> init_states;
+  for (const auto& rule : rules_) {
+    init_states.push_back(rule->compiled_->GetInitState());
+  }
+  GetOrAddProductState(init_states);
+}
+
+ProductMonitor::State ProductMonitor::MakeState() const {
+  return State{0, std::vector<size_t>(rules_.size(), 0)};
+}
+
+void ProductMonitor::Evaluate(const EvaluationMap& labels, State* state,
+                              double* penalties) {
+  const bool alive = RuleMonitor::IsAlive(labels);
+  TransitionKey key{state->product_state, alive_bit_, alive ? alive_bit_ : 0};
+  for (size_t i = 0; i < labels_.size(); ++i) {
+    auto it = labels.find(labels_[i]);
+    if (it != labels.end()) {
+      const APMask bit = APMask(1) << (i + 1);
+      key.known |= bit;
+      if (it->second) {
+        key.values |= bit;
+      }
+    }
+  }
+  Transition transition;
+  if (alive && key.known != all_bits_) {
+    // Missing labels abort in ComputeTransition unless their rules are
+    // decided, which the masked key could not tell apart
+    transition = ComputeTransition(key, alive);
+  } else {
+    const APMask support = supports_[state->product_state];
+    key.known &= support;
+    key.values &= support;
+    auto it = transitions_.find(key);
+    if (it != transitions_.end()) {
+      transition = it->second;
+    } else {
+      transition = ComputeTransition(key, alive);
+      if (transitions_.size() < kMaxCachedTransitions) {
+        transitions_.emplace(key, transition);
+      }
+    }
+  }
+  RecordTransition(state->product_state, transition);
+  state->product_state = transition.next;
+  for (size_t r = 0; r < rules_.size(); ++r) {
+    if ((transition.violated >> r) & 1) {
+      ++state->violations[r];
+      penalties[r] = rules_[r]->weight_;
+    } else {
+      penalties[r] = 0.0;
+    }
+  }
+}
+
+std::vector<double> ProductMonitor::Evaluate(const EvaluationMap& labels,
+                                             State& state) {
+  std::vector<double> penalties(rules_.size());
+  Evaluate(labels, &state, penalties.data());
+  return penalties;
+}
+
+ProductMonitor::Transition ProductMonitor::ComputeTransition(
+    const TransitionKey& key, bool alive) {
+  std::vector<uint32_t> next_states(
+      product_states_.begin() + key.product_state * rules_.size(),
+      product_states_.begin() + (key.product_state + 1) * rules_.size());
+  Transition transition{0, 0, 0, 0};
+  for (size_t r = 0; r < rules_.size(); ++r) {
+    const RuleMonitor& rule = *rules_[r];
+    if (alive && rule.IsDecided(next_states[r])) {
+      continue;
+    }
+    const uint64_t rule_bit = uint64_t(1) << r;
+    transition.stepped |= rule_bit;
+    APMask known = 0;
+    APMask values = 0;
+    for (size_t i = 0; i < projections_[r].size(); ++i) {
+      const APProjection& ap = projections_[r][i];
+      if (key.known & ap.product_bit) {
+        known |= ap.rule_bit;
+        if (key.values & ap.product_bit) {
+          values |= ap.rule_bit;
+        }
+      } else if (alive) {
+        // Entry 0 is alive, which is always known
+        LOG(FATAL) << "Rule " << rule.str_formula_
+                   << " undefined! Missing label \""
+                   << rule.ap_alphabet_[rule.label_bindings_[i - 1].ap_idx]
+                          .ap_str
+                   << "\"! Aborting!";
+      }
+    }
+    bool undefined;
+    if (rule.Advance(known, values, alive, &next_states[r], &undefined)) {
+      transition.violated |= rule_bit;
+    }
+    if (undefined) {
+      transition.undefined |= rule_bit;
+    }
+  }
+  transition.next = GetOrAddProductState(next_states);
+  return transition;
+}
+
+void ProductMonitor::RecordTransition(uint32_t product_state,
+                                      const Transition& transition) const {
+  const uint32_t* states =
+      product_states_.data() + product_state * rules_.size();
+  const uint32_t* next_states =
+      product_states_.data() + transition.next * rules_.size();
+  for (size_t r = 0; r < rules_.size(); ++r) {
+    if (!((transition.stepped >> r) & 1)) {
+      continue;
+    }
+    const bool violated = (transition.violated >> r) & 1;
+    rules_[r]->RecordStep(states[r], next_states[r],
+                          (transition.undefined >> r) & 1, violated);
+    if (violated) {
+      // Rules of a product have no placeholders
+      rules_[r]->LogViolation(states[r], nullptr, -1);
+    }
+  }
+}
+
+uint32_t ProductMonitor::GetOrAddProductState(
+    const std::vector<uint32_t>& states) {
+  auto it = product_state_ids_.find(states);
+  if (it != product_state_ids_.end()) {
+    return it->second;
+  }
+  const uint32_t id = static_cast<uint32_t>(GetNumProductStates());
+  product_states_.insert(product_states_.end(), states.begin(), states.end());
+  product_state_ids_.insert({states, id});
+  APMask support = alive_bit_;
+  for (size_t r = 0; r < rules_.size(); ++r) {
+    const APMask rule_support = rules_[r]->compiled_->GetSupport(states[r]);
+    for (const APProjection& ap : projections_[r]) {
+      if (rule_support & ap.rule_bit) {
+        support |= ap.product_bit;
+      }
+    }
+  }
+  supports_.push_back(support);
+  VLOG(3) << "Product monitor has " << id + 1 << " states";
+  return id;
+}
+
+std::vector<double> ProductMonitor::FinalTransit(const State& state) const {
+  std::vector<double> penalties(rules_.size());
+  for (size_t r = 0; r < rules_.size(); ++r) {
+    penalties[r] = rules_[r]->FinalPenalty(GetRuleState(state, r));
+  }
+  return penalties;
+}
+
+size_t ProductMonitor::GetNumRules() const { return rules_.size(); }
+const RuleMonitor::RuleMonitorSPtr& ProductMonitor::GetRule(
+    size_t rule_idx) const {
+  return rules_.at(rule_idx);
+}
+uint32_t ProductMonitor::GetRuleState(const State& state,
+                                      size_t rule_idx) const {
+  return product_states_[state.product_state * rules_.size() + rule_idx];
+}
+size_t ProductMonitor::GetNumProductStates() const {
+  return rules_.empty() ? product_state_ids_.size()
+                        : product_states_.size() / rules_.size();
+}
+size_t ProductMonitor::GetNumCachedTransitions() const {
+  return transitions_.size();
+}
+
+bool ProductMonitor::TransitionKey::operator==(
+    const TransitionKey& rhs) const {
+  return product_state == rhs.product_state && known == rhs.known &&
+         values == rhs.values;
+}
+
+size_t ProductMonitor::TransitionKeyHash::operator()(
+    const TransitionKey& key) const {
+  size_t seed = std::hash<uint32_t>()(key.product_state);
+  // Same combination as boost::hash_combine
+  seed ^= std::hash<APMask>()(key.known) + 0x9e3779b9 + (seed << 6) +
+          (seed >> 2);
+  seed ^= std::hash<APMask>()(key.values) + 0x9e3779b9 + (seed << 6) +
+          (seed >> 2);
+  return seed;
+}
+
+size_t ProductMonitor::StateTupleHash::operator()(
+    const std::vector<uint32_t>& states) const {
+  size_t seed = states.size();
+  for (uint32_t state : states) {
+    seed ^= std::hash<uint32_t>()(state) + 0x9e3779b9 + (seed << 6) +
+            (seed >> 2);
+  }
+  return seed;
+}
+
+}  // namespace ltl
@@ -0,0 +1,123 @@
+// Copyright (c) 2020 Klemens Esterle, Luis Gressenbuch
+//
+// This work is licensed under the terms of the MIT license.
+// For a copy, see <https://opensource.org/licenses/MIT>.
+
+#ifndef LTL_PRODUCT_MONITOR_H_
+#define LTL_PRODUCT_MONITOR_H_
+
+#include <cstdint>
+#include <unordered_map>
+#include <vector>
+
+#include "bark/world/evaluation/ltl/label/label.h"
+#include "ltl/compiled_automaton.h"
+#include "ltl/rule_monitor.h"
+
+namespace ltl {
+using bark::world::evaluation::EvaluationMap;
+using bark::world::evaluation::Label;
+
+/// Monitors a set of rules that are not agent specific as one automaton.
+///
+/// A product state is the tuple of the automaton states of all rules. Product
+/// states and their transitions are created lazily: the first time a
+/// valuation is seen in a product state, every rule is advanced as by
+/// RuleMonitor::Evaluate and the resulting product state and the set of
+/// violated rules are cached. The cache is keyed by the valuation of the
+/// labels the component states depend on, so later steps which only differ
+/// in other labels need a single lookup for the whole rule set. At most
+/// kMaxCachedTransitions transitions are cached, further misses are computed
+/// without caching. Weights, priorities, the reset on violation, the metrics
+/// and the violation logs of the individual rules are preserved.
+///
+/// Not thread-safe, the product is extended during evaluation.
+class ProductMonitor {
+ public:
+  static constexpr size_t kMaxRules = 64;
+  static constexpr size_t kMaxCachedTransitions = 1 << 16;
+
+  struct State {
+    uint32_t product_state;
+    // Violations per rule
+    std::vector<size_t> violations;
+  };
+
+  explicit ProductMonitor(
+      const std::vector<RuleMonitor::RuleMonitorSPtr>& rules);
+
+  /// Product state in which all rules are in their initial state.
+  State MakeState() const;
+
+  /// Advance all rules.
+  /// \param penalties Output, one penalty per rule
+  void Evaluate(const EvaluationMap& labels, State* state, double* penalties);
+  std::vector<double> Evaluate(const EvaluationMap& labels, State& state);
+  /// Penalties of all rules at the end of the episode.
+  std::vector<double> FinalTransit(const State& state) const;
+
+  size_t GetNumRules() const;
+  const RuleMonitor::RuleMonitorSPtr& GetRule(size_t rule_idx) const;
+  /// Automaton state of one rule in state.
+  uint32_t GetRuleState(const State& state, size_t rule_idx) const;
+  size_t GetNumProductStates() const;
+  size_t GetNumCachedTransitions() const;
+
+ private:
+  typedef CompiledAutomaton::APMask APMask;
+
+  struct TransitionKey {
+    bool operator==(const TransitionKey& rhs) const;
+    uint32_t product_state;
+    APMask known;
+    APMask values;
+  };
+  struct TransitionKeyHash {
+    size_t operator()(const TransitionKey& key) const;
+  };
+  struct Transition {
+    uint32_t next;
+    // Bit i is set if rule i is advanced, i.e. not skipped as decided
+    uint64_t stepped;
+    // Bit i is set if the step of rule i is undefined
+    uint64_t undefined;
+    // Bit i is set if rule i is violated
+    uint64_t violated;
+  };
+  struct StateTupleHash {
+    size_t operator()(const std::vector<uint32_t>& states) const;
+  };
+
+  // Product APs and their bits in the automata of the rules
+  struct APProjection {
+    APMask product_bit;
+    APMask rule_bit;
+  };
+
+  uint32_t GetOrAddProductState(const std::vector<uint32_t>& states);
+  Transition ComputeTransition(const TransitionKey& key, bool alive);
+  /// Records the metrics and violations of all rules for a transition taken
+  /// from product_state.
+  void RecordTransition(uint32_t product_state,
+                        const Transition& transition) const;
+
+  std::vector<RuleMonitor::RuleMonitorSPtr> rules_;
+  // Labels of the product APs, alive excluded
+  std::vector<Label> labels_;
+  APMask alive_bit_;
+  // Bits of all product APs
+  APMask all_bits_;
+  std::vector<std::vector<APProjection>> projections_;
+  // Rule states of each product state, GetNumRules() entries each
+  std::vector<uint32_t> product_states_;
+  // Product APs the rule states of each product state depend on
+  std::vector<APMask> supports_;
+  std::unordered_map<std::vector<uint32_t>, uint32_t, StateTupleHash>
+      product_state_ids_;
+  std::unordered_map<TransitionKey, Transition, TransitionKeyHash>
+      transitions_;
+};
+
+}  // namespace ltl
+
+#endif  // LTL_PRODUCT_MONITOR_H_
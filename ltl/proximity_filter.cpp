@@ -0,0 +1,126 @@
+// Copyright (c) 2020 Klemens Esterle, Luis Gressenbuch
+//
+// This work is licensed under the terms of the MIT license.
+// For a copy, see <https://opensource.org/licenses/MIT>.
+
+#include "ltl/proximity_filter.h"
+
+#include <algorithm>
+#include <cmath>
+
+#include "glog/logging.h"
+
+namespace ltl {
+
+ProximityFilter::ProximityFilter(double max_distance)
+    : max_distance_(max_distance),
+      max_distance_sq_(max_distance * max_distance) {
+  CHECK_GT(max_distance, 0.0) << "Maximum distance has to be positive!";
+}
+
+namespace {
+uint64_t PackCell(int32_t cx, int32_t cy) {
+  return (static_cast<uint64_t>(static_cast<uint32_t>(cx)) << 32) |
+         static_cast<uint32_t>(cy);
+}
+}  // namespace
+
+uint64_t ProximityFilter::GetCell(double x, double y) const {
+  return PackCell(static_cast<int32_t>(std::floor(x / max_distance_)),
+                  static_cast<int32_t>(std::floor(y / max_distance_)));
+}
+
+void ProximityFilter::RemoveFromCell(int agent_id, uint64_t cell) {
+  auto it = cells_.find(cell);
+  std::vector<int>& agents = it->second;
+  *std::find(agents.begin(), agents.end(), agent_id) = agents.back();
+  agents.pop_back();
+  if (agents.empty()) {
+    cells_.erase(it);
+  }
+}
+
+void ProximityFilter::SetPosition(int agent_id, double x, double y) {
+  const uint64_t cell = GetCell(x, y);
+  auto it = positions_.find(agent_id);
+  if (it == positions_.end()) {
+    positions_.emplace(agent_id, Position{x, y, cell});
+    cells_[cell].push_back(agent_id);
+    return;
+  }
+  if (it->second.cell != cell) {
+    RemoveFromCell(agent_id, it->second.cell);
+    cells_[cell].push_back(agent_id);
+  }
+  it->second = {x, y, cell};
+}
+
+void ProximityFilter::RemoveAgent(int agent_id) {
+  auto it = positions_.find(agent_id);
+  if (it != positions_.end()) {
+    RemoveFromCell(agent_id, it->second.cell);
+    positions_.erase(it);
+  }
+}
+
+void ProximityFilter::Clear() {
+  positions_.clear();
+  cells_.clear();
+}
+
+bool ProximityFilter::Neighbors(int agent_id,
+                                std::vector<int>* neighbors) const {
+  auto it = positions_.find(agent_id);
+  if (it == positions_.end()) {
+    return false;
+  }
+  const int32_t cx = static_cast<int32_t>(it->second.cell >> 32);
+  const int32_t cy = static_cast<int32_t>(it->second.cell);
+  for (int32_t dx = -1; dx <= 1; ++dx) {
+    for (int32_t dy = -1; dy <= 1; ++dy) {
+      auto cell = cells_.find(PackCell(cx + dx, cy + dy));
+      if (cell != cells_.end()) {
+        neighbors->insert(neighbors->end(), cell->second.begin(),
+                          cell->second.end());
+      }
+    }
+  }
+  return true;
+}
+
+bool ProximityFilter::operator()(const int* agent_ids, size_t arity) const {
+  for (size_t i = 0; i < arity; ++i) {
+    auto a = positions_.find(agent_ids[i]);
+    if (a == positions_.end()) {
+      continue;
+    }
+    for (size_t j = i + 1; j < arity; ++j) {
+      auto b = positions_.find(agent_ids[j]);
+      if (b == positions_.end()) {
+        continue;
+      }
+      const double dx = a->second.x - b->second.x;
+      const double dy = a->second.y - b->second.y;
+      if (dx * dx + dy * dy > max_distance_sq_) {
+        return false;
+      }
+    }
+  }
+  return true;
+}
+
+RuleStateSet::RelevanceFilter ProximityFilter::Bind(
+    const std::shared_ptr<const ProximityFilter>& filter) {
+  return [filter](const int* agent_ids, size_t arity) {
+    return (*filter)(agent_ids, arity);
+  };
+}
+
+RuleStateSet::NeighborQuery ProximityFilter::BindNeighbors(
+    const std::shared_ptr<const ProximityFilter>& filter) {
+  return [filter](int agent_id, std::vector<int>* neighbors) {
+    return filter->Neighbors(agent_id, neighbors);
+  };
+}
+
+}  // namespace ltl
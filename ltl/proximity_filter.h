@@ -0,0 +1,61 @@
+// Copyright (c) 2020 Klemens Esterle, Luis Gressenbuch
+//
+// This work is licensed under the terms of the MIT license.
+// For a copy, see <https://opensource.org/licenses/MIT>.
+
+#ifndef LTL_PROXIMITY_FILTER_H_
+#define LTL_PROXIMITY_FILTER_H_
+
+#include <cstdint>
+#include <memory>
+#include <unordered_map>
+#include <vector>
+
+#include "ltl/rule_state_set.h"
+
+namespace ltl {
+
+/// Spatial relevance predicate for RuleStateSet: an agent tuple is relevant
+/// if all of its agents are within max_distance of each other. Agents without
+/// a known position are always relevant. Positions are bucketed into a grid
+/// of max_distance cells, so neighbor queries only visit the adjacent cells.
+class ProximityFilter {
+ public:
+  explicit ProximityFilter(double max_distance);
+
+  /// Update the position of an agent, usually once per step.
+  void SetPosition(int agent_id, double x, double y);
+  void RemoveAgent(int agent_id);
+  void Clear();
+
+  bool operator()(const int* agent_ids, size_t arity) const;
+
+  /// Appends the agents within the cells around agent_id to neighbors.
+  /// Returns false if the position of agent_id is unknown.
+  bool Neighbors(int agent_id, std::vector<int>* neighbors) const;
+
+  /// Filter for RuleStateSet::SetRelevanceFilter, sharing filter's positions.
+  static RuleStateSet::RelevanceFilter Bind(
+      const std::shared_ptr<const ProximityFilter>& filter);
+  /// Neighbor query for RuleStateSet::SetRelevanceFilter.
+  static RuleStateSet::NeighborQuery BindNeighbors(
+      const std::shared_ptr<const ProximityFilter>& filter);
+
+ private:
+  struct Position {
+    double x;
+    double y;
+    uint64_t cell;
+  };
+  uint64_t GetCell(double x, double y) const;
+  void RemoveFromCell(int agent_id, uint64_t cell);
+
+  double max_distance_;
+  double max_distance_sq_;
+  std::unordered_map<int, Position> positions_;
+  std::unordered_map<uint64_t, std::vector<int>> cells_;
+};
+
+}  // namespace ltl
+
+#endif  // LTL_PROXIMITY_FILTER_H_
@@ -0,0 +1,140 @@
+// Copyright (c) 2020 Klemens Esterle, Luis Gressenbuch
+//
+// This work is licensed under the terms of the MIT license.
+// For a copy, see <https://opensource.org/licenses/MIT>.
+
+#include "ltl/rule_evaluator.h"
+
+#include <algorithm>
+#include <iterator>
+#include <numeric>
+
+#include "glog/logging.h"
+
+namespace ltl {
+
+RuleEvaluator::RuleEvaluator(size_t num_threads, size_t chunk_size)
+    : chunk_size_(chunk_size), pool_(num_threads) {
+  CHECK_GT(chunk_size, 0) << "Chunk size must be positive!";
+}
+
+size_t RuleEvaluator::AddRule(const RuleMonitor::RuleMonitorSPtr& monitor) {
+  rule_states_.push_back(monitor->MakeRuleStateSet(agents_));
+  penalties_.emplace_back();
+  return rule_states_.size() - 1;
+}
+
+size_t RuleEvaluator::GetNumRules() const { return rule_states_.size(); }
+
+void RuleEvaluator::AddAgents(const std::vector<int>& agent_ids) {
+  // Label registries are shared between rules, so instances are not created
+  // in parallel
+  for (RuleStateSet& states : rule_states_) {
+    states.AddAgents(agent_ids);
+  }
+  std::vector<int> added(agent_ids);
+  std::sort(added.begin(), added.end());
+  std::vector<int> agents;
+  std::set_union(agents_.begin(), agents_.end(), added.begin(), added.end(),
+                 std::back_inserter(agents));
+  agents_.swap(agents);
+}
+
+void RuleEvaluator::RemoveAgents(const std::vector<int>& agent_ids,
+                                 const RuleStateSet::RetireCallback& on_retire) {
+  for (RuleStateSet& states : rule_states_) {
+    states.RemoveAgents(agent_ids, on_retire);
+  }
+  for (int id : agent_ids) {
+    auto it = std::lower_bound(agents_.begin(), agents_.end(), id);
+    if (it != agents_.end() && *it == id) {
+      agents_.erase(it);
+    }
+  }
+}
+
+void RuleEvaluator::UpdateRelevance() {
+  for (RuleStateSet& states : rule_states_) {
+    states.UpdateRelevance();
+  }
+}
+
+std::vector<double> RuleEvaluator::Evaluate(const EvaluationMap& labels) {
+  return EvaluateParallel(labels);
+}
+
+std::vector<double> RuleEvaluator::Evaluate(const LabelFrame& labels) {
+  return EvaluateParallel(labels);
+}
+
+template <typename Labels>
+std::vector<double> RuleEvaluator::EvaluateParallel(const Labels& labels) {
+  std::vector<ThreadPool::Task> tasks;
+  for (size_t r = 0; r < rule_states_.size(); ++r) {
+    RuleStateSet* states = &rule_states_[r];
+    penalties_[r].resize(states->Size());
+    double* penalties = penalties_[r].data();
+    for (size_t begin = 0; begin < states->Size(); begin += chunk_size_) {
+      const size_t end = std::min(begin + chunk_size_, states->Size());
+      tasks.push_back([&labels, states, penalties, begin, end] {
+        states->Evaluate(labels, begin, end, penalties + begin);
+      });
+    }
+  }
+  pool_.Run(tasks);
+
+  std::vector<double> rule_penalties(rule_states_.size());
+  for (size_t r = 0; r < rule_states_.size(); ++r) {
+    rule_penalties[r] =
+        std::accumulate(penalties_[r].begin(), penalties_[r].end(), 0.0);
+  }
+  return rule_penalties;
+}
+
+std::vector<double> RuleEvaluator::FinalTransit() const {
+  std::vector<double> rule_penalties(rule_states_.size());
+  std::vector<ThreadPool::Task> tasks;
+  for (size_t r = 0; r < rule_states_.size(); ++r) {
+    const RuleStateSet* states = &rule_states_[r];
+    double* penalty = &rule_penalties[r];
+    tasks.push_back([states, penalty] { *penalty = states->FinalTransit(); });
+  }
+  pool_.Run(tasks);
+  return rule_penalties;
+}
+
+void RuleEvaluator::SaveSnapshot(Snapshot* snapshot) {
+  snapshot->rule_states.resize(rule_states_.size());
+  for (size_t r = 0; r < rule_states_.size(); ++r) {
+    rule_states_[r].SaveSnapshot(&snapshot->rule_states[r]);
+  }
+  snapshot->agents = agents_;
+}
+
+RuleEvaluator::Snapshot RuleEvaluator::SaveSnapshot() {
+  Snapshot snapshot;
+  SaveSnapshot(&snapshot);
+  return snapshot;
+}
+
+void RuleEvaluator::RestoreSnapshot(const Snapshot& snapshot) {
+  CHECK_EQ(snapshot.rule_states.size(), rule_states_.size())
+      << "Snapshot has a different number of rules!";
+  for (size_t r = 0; r < rule_states_.size(); ++r) {
+    rule_states_[r].RestoreSnapshot(snapshot.rule_states[r]);
+  }
+  agents_ = snapshot.agents;
+}
+
+const std::vector<double>& RuleEvaluator::GetPenalties(size_t rule_idx) const {
+  return penalties_.at(rule_idx);
+}
+RuleStateSet& RuleEvaluator::GetRuleStates(size_t rule_idx) {
+  return rule_states_.at(rule_idx);
+}
+const RuleStateSet& RuleEvaluator::GetRuleStates(size_t rule_idx) const {
+  return rule_states_.at(rule_idx);
+}
+size_t RuleEvaluator::GetNumThreads() const { return pool_.GetNumThreads(); }
+
+}  // namespace ltl
@@ -0,0 +1,88 @@
+// Copyright (c) 2020 Klemens Esterle, Luis Gressenbuch
+//
+// This work is licensed under the terms of the MIT license.
+// For a copy, see <https://opensource.org/licenses/MIT>.
+
+#ifndef LTL_RULE_EVALUATOR_H_
+#define LTL_RULE_EVALUATOR_H_
+
+#include <memory>
+#include <vector>
+
+#include "bark/world/evaluation/ltl/label/label.h"
+#include "ltl/label_frame.h"
+#include "ltl/rule_monitor.h"
+#include "ltl/rule_state_set.h"
+#include "ltl/thread_pool.h"
+
+namespace ltl {
+using bark::world::evaluation::EvaluationMap;
+
+/// Evaluates a set of rules and all their states on a thread pool.
+///
+/// Each step is split into tasks of at most chunk_size instances of one rule,
+/// which are balanced over the threads by work stealing. Penalties are summed
+/// per rule in instance order after all tasks finished, so the results do not
+/// depend on the number of threads or the scheduling.
+class RuleEvaluator {
+ public:
+  /// Rule states of all rules, see SaveSnapshot.
+  struct Snapshot {
+    std::vector<RuleStateSet::Snapshot> rule_states;
+    std::vector<int> agents;
+  };
+
+  /// \param num_threads Number of threads, 0 for the number of hardware
+  /// threads
+  /// \param chunk_size Maximum number of instances evaluated by one task
+  explicit RuleEvaluator(size_t num_threads = 0, size_t chunk_size = 256);
+
+  /// Add a rule instantiated for all agents currently in the scene.
+  /// \return Index of the rule
+  size_t AddRule(const RuleMonitor::RuleMonitorSPtr& monitor);
+  size_t GetNumRules() const;
+
+  void AddAgents(const std::vector<int>& agent_ids);
+  /// Remove agents and retire all instances involving them.
+  void RemoveAgents(const std::vector<int>& agent_ids,
+                    const RuleStateSet::RetireCallback& on_retire = nullptr);
+  /// Calls RuleStateSet::UpdateRelevance of all rules.
+  void UpdateRelevance();
+
+  /// Advance all rule states on the same labels.
+  /// \return Sum of the penalties of each rule
+  std::vector<double> Evaluate(const EvaluationMap& labels);
+  std::vector<double> Evaluate(const LabelFrame& labels);
+  /// Penalties at the end of the episode, summed per rule.
+  std::vector<double> FinalTransit() const;
+
+  /// Save the rule states of all rules, e.g. before branching a rollout.
+  /// Snapshots taken while the agents do not change share their agent
+  /// tuples, see RuleStateSet::SaveSnapshot.
+  void SaveSnapshot(Snapshot* snapshot);
+  Snapshot SaveSnapshot();
+  /// Return to a snapshot of this evaluator. Rules added after the snapshot
+  /// was taken are not allowed.
+  void RestoreSnapshot(const Snapshot& snapshot);
+
+  /// Penalties of the instances of rule_idx in the last call to Evaluate.
+  const std::vector<double>& GetPenalties(size_t rule_idx) const;
+  RuleStateSet& GetRuleStates(size_t rule_idx);
+  const RuleStateSet& GetRuleStates(size_t rule_idx) const;
+  size_t GetNumThreads() const;
+
+ private:
+  template <typename Labels>
+  std::vector<double> EvaluateParallel(const Labels& labels);
+
+  size_t chunk_size_;
+  std::vector<RuleStateSet> rule_states_;
+  std::vector<std::vector<double>> penalties_;
+  std::vector<int> agents_;
+  // Mutable, FinalTransit is logically const
+  mutable ThreadPool pool_;
+};
+
+}  // namespace ltl
+
+#endif  // LTL_RULE_EVALUATOR_H_
@@ -0,0 +1,217 @@
+// Copyright (c) 2020 Klemens Esterle, Luis Gressenbuch
+//
+// This work is licensed under the terms of the MIT license.
+// For a copy, see <https://opensource.org/licenses/MIT>.
+
+#include "ltl/rule_library.h"
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include <cerrno>
+#include <cstdio>
+#include <cstring>
+#include <fstream>
+#include <stdexcept>
+#include <system_error>
+
+#include "glog/logging.h"
+#include "ltl/binary_io.h"
+
+namespace ltl {
+namespace {
+
+// Throws the error of the last failed system call
+[[noreturn]] void ThrowSystemError(const std::string& what) {
+  throw std::system_error(errno, std::generic_category(), what);
+}
+
+}  // namespace
+
+std::string RuleLibrary::Serialize(const std::vector<RuleMonitorSPtr>& rules) {
+  std::string data;
+  BinaryWriter writer(&data);
+  writer.Write(kLibraryMagic);
+  writer.Write(kLibraryVersion);
+  writer.Write<uint64_t>(rules.size());
+  for (const auto& rule : rules) {
+    // Rules start aligned, so their tables can be used in place
+    const std::string rule_data = rule->Serialize();
+    writer.Write<uint64_t>(rule_data.size());
+    writer.Align();
+    writer.WriteBytes(rule_data.data(), rule_data.size());
+  }
+  return data;
+}
+
+void RuleLibrary::Save(const std::string& fname,
+                       const std::vector<RuleMonitorSPtr>& rules) {
+  const std::string data = Serialize(rules);
+  // Replace the file atomically, it may be mapped by other processes
+  const std::string tmp_fname = fname + ".tmp";
+  std::ofstream os(tmp_fname, std::ios::binary);
+  os.write(data.data(), data.size());
+  os.close();
+  if (!os) {
+    std::remove(tmp_fname.c_str());
+    throw std::runtime_error("Could not write rule library " + fname);
+  }
+  if (std::rename(tmp_fname.c_str(), fname.c_str()) != 0) {
+    const int error = errno;
+    std::remove(tmp_fname.c_str());
+    throw std::system_error(error, std::generic_category(),
+                            "Could not write rule library " + fname);
+  }
+}
+
+std::vector<RuleLibrary::RuleMonitorSPtr> RuleLibrary::Load(
+    const std::string& fname) {
+  const int fd = open(fname.c_str(), O_RDONLY);
+  if (fd < 0) {
+    ThrowSystemError("Could not open rule library " + fname);
+  }
+  return LoadMapped(fd, fname);
+}
+
+std::vector<RuleLibrary::RuleMonitorSPtr> RuleLibrary::Load(const char* data,
+                                                            size_t size) {
+  return Load(data, size, nullptr);
+}
+
+void RuleLibrary::SaveShared(const std::string& name,
+                             const std::vector<RuleMonitorSPtr>& rules) {
+  const std::string data = Serialize(rules);
+  // Do not truncate a segment other processes may have mapped, create a new
+  // one instead
+  shm_unlink(name.c_str());
+  const int fd = shm_open(name.c_str(), O_CREAT | O_EXCL | O_RDWR, 0644);
+  if (fd < 0) {
+    ThrowSystemError("Could not create shared memory " + name);
+  }
+  void* mapping = MAP_FAILED;
+  if (ftruncate(fd, data.size()) == 0) {
+    mapping =
+        mmap(nullptr, data.size(), PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+  }
+  if (mapping == MAP_FAILED) {
+    const int error = errno;
+    close(fd);
+    shm_unlink(name.c_str());
+    throw std::system_error(error, std::generic_category(),
+                            "Could not write shared memory " + name);
+  }
+  std::memcpy(mapping, data.data(), data.size());
+  munmap(mapping, data.size());
+  close(fd);
+}
+
+std::vector<RuleLibrary::RuleMonitorSPtr> RuleLibrary::AttachShared(
+    const std::string& name) {
+  const int fd = shm_open(name.c_str(), O_RDONLY, 0);
+  if (fd < 0) {
+    ThrowSystemError("Could not open shared memory " + name);
+  }
+  return LoadMapped(fd, name);
+}
+
+void RuleLibrary::UnlinkShared(const std::string& name) {
+  if (shm_unlink(name.c_str()) != 0) {
+    LOG(WARNING) << "Could not unlink shared memory " << name << ": "
+                 << std::strerror(errno);
+  }
+}
+
+std::vector<RuleLibrary::RuleMonitorSPtr> RuleLibrary::LoadMapped(
+    int fd, const std::string& name) {
+  struct stat st;
+  if (fstat(fd, &st) != 0) {
+    const int error = errno;
+    close(fd);
+    throw std::system_error(error, std::generic_category(),
+                            "Could not stat rule library " + name);
+  }
+  const size_t size = st.st_size;
+  if (size == 0) {
+    close(fd);
+    throw std::invalid_argument("Rule library " + name + " is empty!");
+  }
+  void* mapping = mmap(nullptr, size, PROT_READ, MAP_SHARED, fd, 0);
+  const int error = errno;
+  close(fd);
+  if (mapping == MAP_FAILED) {
+    throw std::system_error(error, std::generic_category(),
+                            "Could not map rule library " + name);
+  }
+  // Unmapped once the last rule using it is destroyed
+  std::shared_ptr<const void> storage(
+      mapping, [size](const void* data) {
+        munmap(const_cast<void*>(data), size);
+      });
+  return Load(static_cast<const char*>(mapping), size, storage);
+}
+
+std::vector<RuleLibrary::RuleMonitorSPtr> RuleLibrary::Load(
+    const char* data, size_t size,
+    const std::shared_ptr<const void>& storage) {
+  BinaryReader reader(data, size);
+  CheckData(reader.Read<uint32_t>() == kLibraryMagic, "Not a rule library!");
+  CheckData(reader.Read<uint32_t>() == kLibraryVersion,
+            "Unsupported rule library version!");
+  const uint64_t num_rules = reader.Read<uint64_t>();
+  std::vector<RuleMonitorSPtr> rules;
+  for (uint64_t i = 0; i < num_rules; ++i) {
+    const uint64_t rule_size = reader.Read<uint64_t>();
+    reader.Align();
+    const size_t offset = reader.GetPosition();
+    CheckData(rule_size <= size - offset, "Corrupt rule library!");
+    rules.push_back(
+        RuleMonitor::Deserialize(data + offset, rule_size, storage));
+    reader.Skip(rule_size);
+  }
+  return rules;
+}
+
+RuleLoader::RuleLoader(std::vector<RuleSpec> specs)
+    : specs_(std::move(specs)), promises_(specs_.size()) {
+  for (auto& promise : promises_) {
+    rules_.push_back(promise.get_future().share());
+  }
+  thread_ = std::thread([this] {
+    for (size_t i = 0; i < specs_.size(); ++i) {
+      const RuleSpec& spec = specs_[i];
+      try {
+        promises_[i].set_value(
+            RuleMonitor::MakeRule(spec.formula, spec.weight, spec.priority));
+      } catch (...) {
+        promises_[i].set_exception(std::current_exception());
+      }
+    }
+    VLOG(1) << "Built " << specs_.size() << " rules";
+  });
+}
+
+RuleLoader::~RuleLoader() { thread_.join(); }
+
+size_t RuleLoader::Size() const { return rules_.size(); }
+
+const std::shared_future<RuleLoader::RuleMonitorSPtr>& RuleLoader::GetRule(
+    size_t idx) const {
+  return rules_.at(idx);
+}
+
+bool RuleLoader::IsReady(size_t idx) const {
+  return rules_.at(idx).wait_for(std::chrono::seconds(0)) ==
+         std::future_status::ready;
+}
+
+std::vector<RuleLoader::RuleMonitorSPtr> RuleLoader::GetAll() const {
+  std::vector<RuleMonitorSPtr> rules;
+  for (const auto& rule : rules_) {
+    rules.push_back(rule.get());
+  }
+  return rules;
+}
+
+}  // namespace ltl
@@ -0,0 +1,112 @@
+// Copyright (c) 2020 Klemens Esterle, Luis Gressenbuch
+//
+// This work is licensed under the terms of the MIT license.
+// For a copy, see <https://opensource.org/licenses/MIT>.
+
+#ifndef LTL_RULE_LIBRARY_H_
+#define LTL_RULE_LIBRARY_H_
+
+#include <future>
+#include <memory>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "ltl/common.h"
+#include "ltl/rule_monitor.h"
+
+namespace ltl {
+
+/// Library of precompiled rules, stored in a file or a POSIX shared memory
+/// segment. Loading a library does not invoke Spot, so startup does not pay
+/// for LTL translation.
+class RuleLibrary {
+ public:
+  typedef RuleMonitor::RuleMonitorSPtr RuleMonitorSPtr;
+
+  /// Serialize rules into a library file. Throws std::system_error or
+  /// std::runtime_error if the file cannot be written.
+  static void Save(const std::string& fname,
+                   const std::vector<RuleMonitorSPtr>& rules);
+  /// Load all rules of a library file. The file is memory-mapped and the
+  /// automaton tables are used in place, so processes loading the same file
+  /// share them in the page cache. Throws std::system_error if the file
+  /// cannot be opened or mapped and std::invalid_argument for empty or
+  /// corrupt libraries.
+  static std::vector<RuleMonitorSPtr> Load(const std::string& fname);
+  /// Load all rules of a library in memory. The data is copied.
+  static std::vector<RuleMonitorSPtr> Load(const char* data, size_t size);
+
+  /// Serialize rules into the shared memory segment name, e.g. "/rules",
+  /// replacing an existing one. Throws std::system_error if the segment
+  /// cannot be created or written.
+  static void SaveShared(const std::string& name,
+                         const std::vector<RuleMonitorSPtr>& rules);
+  /// Load all rules of a shared memory segment. The automaton tables are not
+  /// copied, all processes attached to the segment share one instance. The
+  /// derived step lookup tables are still built per process, see
+  /// CompiledAutomaton::Deserialize. Throws like Load.
+  static std::vector<RuleMonitorSPtr> AttachShared(const std::string& name);
+  /// Remove the name of a shared memory segment. Attached processes keep
+  /// their mapping.
+  static void UnlinkShared(const std::string& name);
+
+ private:
+  static constexpr uint32_t kLibraryMagic = 0x4c4c544c;  // "LTLL"
+  static constexpr uint32_t kLibraryVersion = 2;
+
+  static std::string Serialize(const std::vector<RuleMonitorSPtr>& rules);
+  static std::vector<RuleMonitorSPtr> Load(
+      const char* data, size_t size,
+      const std::shared_ptr<const void>& storage);
+  /// Map the library opened as fd read-only and load it in place. Closes fd,
+  /// throws std::system_error if mapping fails and std::invalid_argument for
+  /// an empty library.
+  static std::vector<RuleMonitorSPtr> LoadMapped(int fd,
+                                                 const std::string& name);
+};
+
+/// Formula, weight and priority of a rule, see RuleMonitor::MakeRule.
+struct RuleSpec {
+  std::string formula;
+  double weight;
+  RulePriority priority;
+};
+
+/// Builds rules from formulas in the background.
+///
+/// Rules are built one after another by a background thread, in the order of
+/// the specs. Each one can be used as soon as its future is ready, while the
+/// remaining ones are still being built. Spot is not thread-safe, see
+/// AutomatonCache::LockSpot, so building takes the sum of all translation
+/// times. Formulas differing only in their placeholders are translated once.
+/// Rules with invalid formulas fail with std::invalid_argument when their
+/// future is accessed.
+class RuleLoader {
+ public:
+  typedef RuleMonitor::RuleMonitorSPtr RuleMonitorSPtr;
+
+  explicit RuleLoader(std::vector<RuleSpec> specs);
+  /// Waits for all rules.
+  ~RuleLoader();
+  RuleLoader(const RuleLoader&) = delete;
+  RuleLoader& operator=(const RuleLoader&) = delete;
+
+  size_t Size() const;
+  /// Rule of specs[idx], ready once it has been built.
+  const std::shared_future<RuleMonitorSPtr>& GetRule(size_t idx) const;
+  bool IsReady(size_t idx) const;
+  /// Wait for all rules, in the order of the specs.
+  std::vector<RuleMonitorSPtr> GetAll() const;
+
+ private:
+  std::vector<RuleSpec> specs_;
+  std::vector<std::promise<RuleMonitorSPtr>> promises_;
+  std::vector<std::shared_future<RuleMonitorSPtr>> rules_;
+  // Builds the rules, so the constructor does not block
+  std::thread thread_;
+};
+
+}  // namespace ltl
+
+#endif  // LTL_RULE_LIBRARY_H_
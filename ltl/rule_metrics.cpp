@@ -0,0 +1,177 @@
+// Copyright (c) 2020 Klemens Esterle, Luis Gressenbuch
+//
+// This work is licensed under the terms of the MIT license.
+// For a copy, see <https://opensource.org/licenses/MIT>.
+
+#include "ltl/rule_metrics.h"
+
+#include <algorithm>
+#include <functional>
+#include <queue>
+#include <vector>
+
+namespace ltl {
+
+namespace {
+// Hands out the smallest free slot, so slots stay dense as threads come and
+// go and recorders need only few shards.
+class ThreadSlots {
+ public:
+  size_t Acquire() {
+    std::lock_guard<std::mutex> lock(mutex_);
+    if (free_.empty()) {
+      return num_slots_++;
+    }
+    const size_t slot = free_.top();
+    free_.pop();
+    return slot;
+  }
+  void Release(size_t slot) {
+    std::lock_guard<std::mutex> lock(mutex_);
+    free_.push(slot);
+  }
+
+ private:
+  std::mutex mutex_;
+  size_t num_slots_ = 0;
+  std::priority_queue<size_t, std::vector<size_t>, std::greater<size_t>>
+      free_;
+};
+
+ThreadSlots& GetThreadSlots() {
+  // Never destroyed, threads may exit after static destruction
+  static ThreadSlots* slots = new ThreadSlots();
+  return *slots;
+}
+
+// Slot of the current thread. The mutex of ThreadSlots orders the writes of
+// an exited thread before those of the next thread with the same slot.
+struct ThreadSlot {
+  ThreadSlot() : slot(GetThreadSlots().Acquire()) {}
+  ~ThreadSlot() { GetThreadSlots().Release(slot); }
+  const size_t slot;
+};
+thread_local ThreadSlot thread_slot;
+}  // namespace
+
+std::ostream& operator<<(std::ostream& os, const RuleMetrics& metrics) {
+  os << "steps: " << metrics.steps << ", transitions: " << metrics.transitions
+     << ", violations: " << metrics.violations
+     << ", resets: " << metrics.resets
+     << ", undefined: " << metrics.undefined
+     << ", instances: " << metrics.instances;
+  return os;
+}
+
+RuleMetricsRecorder::ScopedTimer::ScopedTimer(
+    const RuleMetricsRecorder& recorder)
+    : recorder_(nullptr) {
+  if (recorder.latency_tracking_.load(std::memory_order_relaxed)) {
+    recorder_ = &recorder;
+    start_ = std::chrono::steady_clock::now();
+  }
+}
+
+RuleMetricsRecorder::ScopedTimer::~ScopedTimer() {
+  if (recorder_) {
+    recorder_->AddLatency(std::chrono::steady_clock::now() - start_);
+  }
+}
+
+RuleMetricsRecorder::RuleMetricsRecorder() : latency_tracking_(false) {
+  for (auto& shard : shards_) {
+    shard.store(nullptr, std::memory_order_relaxed);
+  }
+}
+
+RuleMetricsRecorder::~RuleMetricsRecorder() {
+  for (auto& shard : shards_) {
+    delete shard.load(std::memory_order_relaxed);
+  }
+}
+
+RuleMetricsRecorder::Shard* RuleMetricsRecorder::GetShard() const {
+  const size_t slot = std::min(thread_slot.slot, kMaxThreadSlots);
+  Shard* shard = shards_[slot].load(std::memory_order_acquire);
+  return shard ? shard : AddShard(slot);
+}
+
+RuleMetricsRecorder::Shard* RuleMetricsRecorder::AddShard(size_t slot) const {
+  std::lock_guard<std::mutex> lock(mutex_);
+  // The shared shard may have been added by another thread
+  Shard* shard = shards_[slot].load(std::memory_order_relaxed);
+  if (shard) {
+    return shard;
+  }
+  shard = new Shard();
+  for (auto& counter : shard->counters) {
+    counter.store(0, std::memory_order_relaxed);
+  }
+  for (auto& bucket : shard->latency) {
+    bucket.store(0, std::memory_order_relaxed);
+  }
+  shard->is_shared = slot == kMaxThreadSlots;
+  shards_[slot].store(shard, std::memory_order_release);
+  return shard;
+}
+
+void RuleMetricsRecorder::AddLatency(std::chrono::nanoseconds duration) const {
+  const uint64_t ns = std::max<int64_t>(duration.count(), 1);
+  const size_t bucket = std::min<size_t>(63 - __builtin_clzll(ns),
+                                         kNumLatencyBuckets - 1);
+  Shard* shard = GetShard();
+  Increment(shard, &shard->latency[bucket], 1);
+}
+
+void RuleMetricsRecorder::SetLatencyTracking(bool enabled) {
+  latency_tracking_ = enabled;
+}
+
+RuleMetrics RuleMetricsRecorder::Get() const {
+  uint64_t counters[NUM_COUNTERS] = {};
+  std::vector<uint64_t> latency(kNumLatencyBuckets, 0);
+  for (const auto& slot : shards_) {
+    const Shard* shard = slot.load(std::memory_order_acquire);
+    if (!shard) {
+      continue;
+    }
+    for (size_t c = 0; c < NUM_COUNTERS; ++c) {
+      counters[c] += shard->counters[c].load(std::memory_order_relaxed);
+    }
+    for (size_t b = 0; b < kNumLatencyBuckets; ++b) {
+      latency[b] += shard->latency[b].load(std::memory_order_relaxed);
+    }
+  }
+  RuleMetrics metrics;
+  metrics.steps = counters[STEPS];
+  metrics.transitions = counters[TRANSITIONS];
+  metrics.violations = counters[VIOLATIONS];
+  metrics.resets = counters[RESETS];
+  metrics.undefined = counters[UNDEFINED];
+  metrics.instances = counters[INSTANCES];
+  if (latency_tracking_) {
+    // Drop empty buckets at the end
+    while (!latency.empty() && latency.back() == 0) {
+      latency.pop_back();
+    }
+    metrics.latency_histogram = std::move(latency);
+  }
+  return metrics;
+}
+
+void RuleMetricsRecorder::Reset() {
+  for (const auto& slot : shards_) {
+    Shard* shard = slot.load(std::memory_order_acquire);
+    if (!shard) {
+      continue;
+    }
+    for (auto& counter : shard->counters) {
+      counter.store(0, std::memory_order_relaxed);
+    }
+    for (auto& bucket : shard->latency) {
+      bucket.store(0, std::memory_order_relaxed);
+    }
+  }
+}
+
+}  // namespace ltl
@@ -0,0 +1,112 @@
+// Copyright (c) 2020 Klemens Esterle, Luis Gressenbuch
+//
+// This work is licensed under the terms of the MIT license.
+// For a copy, see <https://opensource.org/licenses/MIT>.
+
+#ifndef LTL_RULE_METRICS_H_
+#define LTL_RULE_METRICS_H_
+
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <mutex>
+#include <ostream>
+#include <vector>
+
+namespace ltl {
+
+/// Snapshot of the metrics of one rule, summed over all threads.
+struct RuleMetrics {
+  // Steps of rule states, decided states are not stepped
+  uint64_t steps = 0;
+  // Steps that moved to another automaton state without a violation
+  uint64_t transitions = 0;
+  uint64_t violations = 0;
+  // Violations that reset a rule state which had left the initial state
+  uint64_t resets = 0;
+  // Steps on which a guard depended on an undefined label
+  uint64_t undefined = 0;
+  // Rule states created
+  uint64_t instances = 0;
+  // Evaluation calls per duration, entry i counts calls which took
+  // [2^i, 2^(i+1)) nanoseconds. Empty unless latency tracking is enabled.
+  std::vector<uint64_t> latency_histogram;
+};
+
+std::ostream& operator<<(std::ostream& os, const RuleMetrics& metrics);
+
+/// Counters of one rule. Every thread increments its own shard without
+/// synchronization, shards are summed by Get. Shards are indexed by a small
+/// per-thread slot, which is reused once its thread exits. Threads beyond
+/// kMaxThreadSlots share one shard with atomic increments.
+class RuleMetricsRecorder {
+ public:
+  enum Counter {
+    STEPS,
+    TRANSITIONS,
+    VIOLATIONS,
+    RESETS,
+    UNDEFINED,
+    INSTANCES,
+    NUM_COUNTERS
+  };
+  static constexpr size_t kNumLatencyBuckets = 40;
+  static constexpr size_t kMaxThreadSlots = 256;
+
+  /// Records the duration of its scope if latency tracking is enabled.
+  class ScopedTimer {
+   public:
+    explicit ScopedTimer(const RuleMetricsRecorder& recorder);
+    ~ScopedTimer();
+
+   private:
+    const RuleMetricsRecorder* recorder_;
+    std::chrono::steady_clock::time_point start_;
+  };
+
+  RuleMetricsRecorder();
+  ~RuleMetricsRecorder();
+  RuleMetricsRecorder(const RuleMetricsRecorder&) = delete;
+  RuleMetricsRecorder& operator=(const RuleMetricsRecorder&) = delete;
+
+  void Add(Counter counter, uint64_t n = 1) const {
+    Shard* shard = GetShard();
+    Increment(shard, &shard->counters[counter], n);
+  }
+  void SetLatencyTracking(bool enabled);
+  RuleMetrics Get() const;
+  /// Increments of other threads running concurrently may survive.
+  void Reset();
+
+ private:
+  struct alignas(64) Shard {
+    std::atomic<uint64_t> counters[NUM_COUNTERS];
+    std::atomic<uint64_t> latency[kNumLatencyBuckets];
+    // Written by several threads, see kMaxThreadSlots
+    bool is_shared;
+  };
+
+  static void Increment(Shard* shard, std::atomic<uint64_t>* value,
+                        uint64_t n) {
+    if (shard->is_shared) {
+      value->fetch_add(n, std::memory_order_relaxed);
+    } else {
+      // Only the owning thread writes, so no read-modify-write is needed
+      value->store(value->load(std::memory_order_relaxed) + n,
+                   std::memory_order_relaxed);
+    }
+  }
+  Shard* GetShard() const;
+  Shard* AddShard(size_t slot) const;
+  void AddLatency(std::chrono::nanoseconds duration) const;
+
+  std::atomic<bool> latency_tracking_;
+  // Serializes creating shards
+  mutable std::mutex mutex_;
+  // Shard per thread slot, the last one is shared by all remaining threads
+  mutable std::atomic<Shard*> shards_[kMaxThreadSlots + 1];
+};
+
+}  // namespace ltl
+
+#endif  // LTL_RULE_METRICS_H_
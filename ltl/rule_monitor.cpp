@@ -7,21 +7,18 @@
 
 #include <algorithm>
 #include <fstream>
+#include <functional>
 #include <map>
 #include <numeric>
-#include <regex>
 #include <vector>
 
 #include "bark/world/evaluation/ltl/label/label.h"
 #include "glog/logging.h"
-#include "spot/tl/apcollect.hh"
-#include "spot/tl/hierarchy.hh"
-#include "spot/tl/ltlf.hh"
-#include "spot/tl/print.hh"
-#include "spot/twa/bddprint.hh"
+#include "ltl/binary_io.h"
+#include "ltl/rule_state_set.h"
 #include "spot/twaalgos/dot.hh"
 
-#ifdef PROFILING
+#ifdef BUILD_WITH_EASY_PROFILER
 #include <easy/profiler.h>
 #endif
 
@@ -32,222 +29,879 @@ RuleMonitor::RuleMonitor(const std::string& ltl_formula_str, double weight,
       weight_(weight),
       priority_(priority),
       rule_is_agent_specific_(false) {
-  const std::string agent_free_formula = ParseAgents(ltl_formula_str);
-  ltl_formula_ = ParseFormula(agent_free_formula);
-  spot::translator trans;
-  trans.set_pref(spot::postprocessor::Deterministic);
-  trans.set_type(spot::postprocessor::BA);
-  aut_ = trans.run(spot::from_ltlf(ltl_formula_));
-
-  // If formula has the safety property, also accept empty words.
-  if (spot::mp_class(ltl_formula_) == 'S') {
-    // Find unique accepting state
-    size_t final_state;
-    for (final_state = 0; final_state < aut_->num_states(); ++final_state) {
-      if (aut_->state_is_accepting(final_state)) {
+  agent_free_formula_ = ParseAgents(ltl_formula_str);
+  automaton_ = AutomatonCache::GetInstance().Get(agent_free_formula_);
+  compiled_ = automaton_->compiled;
+  InitLabelBindings();
+  DetectSymmetries();
+  ClassifyStates();
+}
+
+RuleMonitor::RuleMonitor(BinaryReader* reader,
+                         const std::shared_ptr<const void>& storage) {
+  CheckData(reader->Read<uint32_t>() == kSerializationMagic,
+            "Not a serialized rule!");
+  CheckData(reader->Read<uint32_t>() == kSerializationVersion,
+            "Unsupported rule serialization version!");
+  str_formula_ = reader->ReadString();
+  agent_free_formula_ = reader->ReadString();
+  weight_ = reader->Read<double>();
+  priority_ = reader->Read<RulePriority>();
+  rule_is_agent_specific_ = reader->Read<uint8_t>();
+  auto automaton = std::make_shared<TranslatedAutomaton>();
+  automaton->formula_str = reader->ReadString();
+  const uint64_t num_aps = reader->Read<uint64_t>();
+  bool has_agent_specific_ap = false;
+  for (uint64_t i = 0; i < num_aps; ++i) {
+    APContainer ap;
+    ap.ap_str = reader->ReadString();
+    ap.placeholder_idx = reader->Read<int32_t>();
+    ap.is_agent_specific = reader->Read<uint8_t>();
+    ap.compiled_idx = -1;
+    // Placeholders index the agent tuples of rule states
+    CheckData(ap.is_agent_specific
+                  ? ap.placeholder_idx >= 0 &&
+                        ap.placeholder_idx < kMaxPlaceholders
+                  : ap.placeholder_idx == -1);
+    has_agent_specific_ap |= ap.is_agent_specific;
+    ap_alphabet_.push_back(ap);
+  }
+  CheckData(has_agent_specific_ap == rule_is_agent_specific_);
+  AssignAutomatonAPs();
+  automaton->compiled = CompiledAutomaton::Deserialize(reader, storage);
+  // The Spot automaton is only created on demand, see PrintToDot
+  automaton_ = automaton;
+  compiled_ = automaton_->compiled;
+  InitLabelBindings();
+  DetectSymmetries();
+  ClassifyStates();
+}
+
+void RuleMonitor::InitLabelBindings() {
+  alive_mask_ = 0;
+  for (size_t i = 0; i < ap_alphabet_.size(); ++i) {
+    APContainer& ap = ap_alphabet_[i];
+    ap.compiled_idx = compiled_->GetAPIndex(ap.automaton_ap);
+    const CompiledAutomaton::APMask bit =
+        ap.compiled_idx >= 0 ? CompiledAutomaton::APMask(1) << ap.compiled_idx
+                             : 0;
+    if (ap.ap_str == "alive") {
+      alive_mask_ = bit;
+    } else {
+      label_bindings_.push_back({static_cast<int>(i), -1, bit, -1});
+    }
+  }
+}
+
+void RuleMonitor::ClassifyStates() {
+  const size_t num_states = compiled_->GetNumStates();
+  decided_states_.resize(num_states);
+  for (uint32_t s = 0; s < num_states; ++s) {
+    decided_states_[s] = compiled_->IsStable(s, alive_mask_, alive_mask_);
+  }
+  ComputeFinalPenalties();
+}
+
+void RuleMonitor::ComputeFinalPenalties() {
+  instance_weight_ = weight_ * GetMultiplicity();
+  const size_t num_states = compiled_->GetNumStates();
+  final_penalties_.resize(num_states);
+  for (uint32_t s = 0; s < num_states; ++s) {
+    // Only alive = false is known, like in Transit a failed step resets the
+    // automaton
+    uint32_t next_state;
+    if (compiled_->Step(s, alive_mask_, 0, &next_state) !=
+        CompiledAutomaton::TRUE) {
+      next_state = compiled_->GetInitState();
+    }
+    final_penalties_[s] =
+        compiled_->IsAccepting(next_state) ? 0.0 : instance_weight_;
+  }
+}
+
+void RuleMonitor::DetectSymmetries() {
+  const size_t k = GetNumPlaceholders();
+  std::vector<int> perm(k);
+  std::iota(perm.begin(), perm.end(), 0);
+  symmetries_.assign(1, perm);
+  if (k < 2 || k > kMaxSymmetryPlaceholders) {
+    return;
+  }
+  while (std::next_permutation(perm.begin(), perm.end())) {
+    if (IsSymmetry(perm)) {
+      symmetries_.push_back(perm);
+    }
+  }
+  // Canonical tuples and multiplicities require a group. The check in
+  // IsSymmetry is incomplete, so compositions may be missing.
+  std::vector<int> composed(k);
+  for (const auto& a : symmetries_) {
+    for (const auto& b : symmetries_) {
+      for (size_t p = 0; p < k; ++p) {
+        composed[p] = a[b[p]];
+      }
+      if (std::find(symmetries_.begin(), symmetries_.end(), composed) ==
+          symmetries_.end()) {
+        VLOG(1) << "Symmetries of " << str_formula_ << " are not closed";
+        symmetries_.resize(1);
+        return;
+      }
+    }
+  }
+}
+
+bool RuleMonitor::IsSymmetry(const std::vector<int>& placeholder_perm) const {
+  // Permutation of the automaton APs induced by placeholder_perm
+  const size_t num_aps = compiled_->GetNumAPs();
+  std::vector<int> ap_perm(num_aps);
+  std::iota(ap_perm.begin(), ap_perm.end(), 0);
+  for (const auto& ap : ap_alphabet_) {
+    if (!ap.is_agent_specific) {
+      continue;
+    }
+    auto image = std::find_if(
+        ap_alphabet_.begin(), ap_alphabet_.end(), [&](const APContainer& b) {
+          return b.ap_str == ap.ap_str &&
+                 b.placeholder_idx == placeholder_perm[ap.placeholder_idx];
+        });
+    if (image == ap_alphabet_.end() ||
+        (ap.compiled_idx < 0) != (image->compiled_idx < 0)) {
+      return false;
+    }
+    if (ap.compiled_idx >= 0) {
+      ap_perm[ap.compiled_idx] = image->compiled_idx;
+    }
+  }
+  auto permute = [&](CompiledAutomaton::APMask mask) {
+    CompiledAutomaton::APMask permuted = 0;
+    for (size_t i = 0; i < num_aps; ++i) {
+      if ((mask >> i) & 1) {
+        permuted |= CompiledAutomaton::APMask(1) << ap_perm[i];
+      }
+    }
+    return permuted;
+  };
+  auto unpermute = [&](CompiledAutomaton::APMask mask) {
+    CompiledAutomaton::APMask unpermuted = 0;
+    for (size_t i = 0; i < num_aps; ++i) {
+      if ((mask >> ap_perm[i]) & 1) {
+        unpermuted |= CompiledAutomaton::APMask(1) << i;
+      }
+    }
+    return unpermuted;
+  };
+
+  // Match state s of the automaton to state t of the renamed automaton,
+  // i.e. the original one reading permuted valuations
+  std::vector<uint32_t> matched(compiled_->GetNumStates(),
+                                ~static_cast<uint32_t>(0));
+  std::vector<uint32_t> pending;
+  const uint32_t init_state = compiled_->GetInitState();
+  matched[init_state] = init_state;
+  pending.push_back(init_state);
+  while (!pending.empty()) {
+    const uint32_t s = pending.back();
+    pending.pop_back();
+    const uint32_t t = matched[s];
+    if (compiled_->IsAccepting(s) != compiled_->IsAccepting(t)) {
+      return false;
+    }
+    const CompiledAutomaton::APMask known =
+        compiled_->GetSupport(s) | unpermute(compiled_->GetSupport(t));
+    std::vector<CompiledAutomaton::APMask> bits;
+    for (size_t i = 0; i < num_aps; ++i) {
+      if ((known >> i) & 1) {
+        bits.push_back(CompiledAutomaton::APMask(1) << i);
+      }
+    }
+    if (bits.size() > CompiledAutomaton::kMaxLookupBits) {
+      return false;
+    }
+    for (uint32_t v = 0; v < (uint32_t(1) << bits.size()); ++v) {
+      CompiledAutomaton::APMask values = 0;
+      for (size_t b = 0; b < bits.size(); ++b) {
+        if ((v >> b) & 1) {
+          values |= bits[b];
+        }
+      }
+      uint32_t next_s, next_t;
+      const auto result_s = compiled_->Step(s, known, values, &next_s);
+      const auto result_t =
+          compiled_->Step(t, permute(known), permute(values), &next_t);
+      if (result_s != result_t) {
+        return false;
+      }
+      if (result_s != CompiledAutomaton::TRUE) {
+        continue;
+      }
+      if (matched[next_s] == ~static_cast<uint32_t>(0)) {
+        matched[next_s] = next_t;
+        pending.push_back(next_s);
+      } else if (matched[next_s] != next_t) {
+        return false;
+      }
+    }
+  }
+  return true;
+}
+
+bool RuleMonitor::IsCanonical(const int* agent_ids) const {
+  const size_t k = GetNumPlaceholders();
+  for (size_t g = 1; g < symmetries_.size(); ++g) {
+    const std::vector<int>& perm = symmetries_[g];
+    for (size_t p = 0; p < k; ++p) {
+      const int permuted = agent_ids[perm[p]];
+      if (permuted < agent_ids[p]) {
+        return false;
+      }
+      if (permuted > agent_ids[p]) {
         break;
       }
     }
-    // Create transition from init state to final state, accepting empty words
-    bdd alive_bdd = bdd_ithvar(aut_->get_dict()->has_registered_proposition(
-        spot::formula::ap("alive"), aut_));
-    aut_->new_edge(aut_->get_init_state_number(), final_state, !alive_bdd);
   }
+  return true;
+}
+
+std::string RuleMonitor::Serialize() const {
+  std::string data;
+  BinaryWriter writer(&data);
+  writer.Write(kSerializationMagic);
+  writer.Write(kSerializationVersion);
+  writer.Write(str_formula_);
+  writer.Write(agent_free_formula_);
+  writer.Write(weight_);
+  writer.Write(priority_);
+  writer.Write<uint8_t>(rule_is_agent_specific_);
+  writer.Write(automaton_->formula_str);
+  writer.Write<uint64_t>(ap_alphabet_.size());
+  for (const auto& ap : ap_alphabet_) {
+    writer.Write(ap.ap_str);
+    writer.Write<int32_t>(ap.placeholder_idx);
+    writer.Write<uint8_t>(ap.is_agent_specific);
+  }
+  compiled_->Serialize(&writer);
+  return data;
+}
+
+RuleMonitor::RuleMonitorSPtr RuleMonitor::Deserialize(const char* data,
+                                                      size_t size) {
+  return Deserialize(data, size, nullptr);
+}
+
+RuleMonitor::RuleMonitorSPtr RuleMonitor::Deserialize(
+    const char* data, size_t size,
+    const std::shared_ptr<const void>& storage) {
+  BinaryReader reader(data, size);
+  return RuleMonitorSPtr(new RuleMonitor(&reader, storage));
+}
+
+RuleMonitor::RuleMonitorSPtr RuleMonitor::Deserialize(
+    const std::string& data) {
+  return Deserialize(data.data(), data.size());
 }
+
+namespace {
+bool IsAPChar(char c) {
+  return (c >= 'a' && c <= 'z') || (c >= '0' && c <= '9') || c == '_';
+}
+bool IsDigit(char c) { return c >= '0' && c <= '9'; }
+}  // namespace
+
 std::string RuleMonitor::ParseAgents(const std::string& ltl_formula_str) {
-  std::string remaining = ltl_formula_str;
-  std::string agent_free_formula;
   // Use #[0-9]+ as suffix of any AP to indicate agent specific rules.
   // Same numbers are instantiated with same agents.
-  std::regex r("([[:lower:][:digit:]_]+)(#([[:digit:]])+)?");
-  std::smatch sm;
-  while (std::regex_search(remaining, sm, r)) {
-    std::string ap_name = sm[1];
-    // Check for boolean constants
-    if (ap_name != "true" && ap_name != "false") {
-      bool ap_is_agent_specific = false;
-      for (const auto& a : sm) {
-        DVLOG(2) << a;
+  struct Occurrence {
+    size_t begin;
+    size_t name_end;
+    // End of the placeholder, if any
+    size_t end;
+    // Index into ap_alphabet_, npos for boolean constants
+    size_t ap_idx;
+  };
+  std::vector<Occurrence> occurrences;
+  std::map<std::pair<std::string, int>, size_t> ap_indices;
+  const std::string& f = ltl_formula_str;
+  size_t pos = 0;
+  while (pos < f.size()) {
+    if (!IsAPChar(f[pos])) {
+      ++pos;
+      continue;
+    }
+    const size_t begin = pos;
+    while (pos < f.size() && IsAPChar(f[pos])) {
+      ++pos;
+    }
+    if (IsDigit(f[begin])) {
+      // Number, e.g. of a bounded operator
+      continue;
+    }
+    const size_t name_end = pos;
+    int agent_id_placeholder = -1;
+    if (pos + 1 < f.size() && f[pos] == '#' && IsDigit(f[pos + 1])) {
+      agent_id_placeholder = 0;
+      for (++pos; pos < f.size() && IsDigit(f[pos]); ++pos) {
+        agent_id_placeholder = agent_id_placeholder * 10 + (f[pos] - '0');
+        CHECK(agent_id_placeholder < kMaxPlaceholders)
+            << "Placeholder too large in " << ltl_formula_str;
       }
-      int agent_id_placeholder = -1;
-      if (sm[3] != "") {
-        agent_id_placeholder = std::stoi(sm[3]);
-        rule_is_agent_specific_ = true;
-        ap_is_agent_specific = true;
+    }
+    std::string ap_name = f.substr(begin, name_end - begin);
+    // Check for boolean constants
+    if (ap_name == "true" || ap_name == "false") {
+      occurrences.push_back({begin, name_end, pos, std::string::npos});
+      continue;
+    }
+    auto inserted = ap_indices.emplace(
+        std::make_pair(ap_name, agent_id_placeholder), ap_alphabet_.size());
+    if (inserted.second) {
+      const bool ap_is_agent_specific = agent_id_placeholder >= 0;
+      rule_is_agent_specific_ |= ap_is_agent_specific;
+      ap_alphabet_.push_back({std::move(ap_name), agent_id_placeholder,
+                              ap_is_agent_specific, -1});
+    }
+    occurrences.push_back({begin, name_end, pos, inserted.first->second});
+  }
+  ap_alphabet_.push_back({"alive", -1, false, -1});
+  AssignAutomatonAPs();
+
+  std::string agent_free_formula;
+  agent_free_formula.reserve(f.size());
+  size_t copied = 0;
+  for (const Occurrence& occurrence : occurrences) {
+    agent_free_formula.append(f, copied, occurrence.begin - copied);
+    if (occurrence.ap_idx == std::string::npos) {
+      agent_free_formula.append(f, occurrence.begin,
+                                occurrence.name_end - occurrence.begin);
+    } else {
+      const APContainer& ap = ap_alphabet_[occurrence.ap_idx];
+      if (ap.automaton_ap != ap.ap_str) {
+        agent_free_formula += '"' + ap.automaton_ap + '"';
+      } else {
+        agent_free_formula += ap.automaton_ap;
       }
-      // TODO: Make ap_alphabet a set, so AP containers are unique
-      ap_alphabet_.insert({ap_name, spot::formula::ap(ap_name),
-                           agent_id_placeholder, ap_is_agent_specific});
     }
-    agent_free_formula += sm.prefix();
-    agent_free_formula += ap_name;
-    remaining = sm.suffix();
+    copied = occurrence.end;
   }
-  ap_alphabet_.insert({"alive", spot::formula::ap("alive"), -1, false});
-  agent_free_formula += remaining;
+  agent_free_formula.append(f, copied, std::string::npos);
   VLOG(2) << "Cleaned formula: " << agent_free_formula;
   return agent_free_formula;
 }
 
+void RuleMonitor::AssignAutomatonAPs() {
+  // An AP used with several placeholders gets one automaton AP per
+  // placeholder. Otherwise, the agent-free formula keeps its name, so rules
+  // differing only in placeholders share their automaton.
+  std::unordered_map<std::string, int> num_uses;
+  for (const auto& ap : ap_alphabet_) {
+    ++num_uses[ap.ap_str];
+  }
+  for (auto& ap : ap_alphabet_) {
+    ap.automaton_ap = ap.ap_str;
+    if (num_uses[ap.ap_str] > 1 && ap.is_agent_specific) {
+      ap.automaton_ap += "#" + std::to_string(ap.placeholder_idx);
+    }
+  }
+}
+
 std::vector<RuleState> RuleMonitor::MakeRuleState(
     const std::vector<int>& new_agent_ids,
     const std::vector<int>& existing_agent_ids) const {
-  int num_other_agents =
-      std::max_element(ap_alphabet_.begin(), ap_alphabet_.end(),
-                       [](const APContainer& a, const APContainer& b) {
-                         return (a.placeholder_idx < b.placeholder_idx);
-                       })
-          ->placeholder_idx +
-      1;
-  num_other_agents = std::max(num_other_agents, 0);
-
-  std::vector<int> current_agent_ids;
-  std::set_union(new_agent_ids.begin(), new_agent_ids.end(),
-                 existing_agent_ids.begin(), existing_agent_ids.end(),
-                 std::back_inserter(current_agent_ids));
   std::vector<RuleState> l;
-  if (IsAgentSpecific() && current_agent_ids.size() >= num_other_agents) {
-    std::vector<std::vector<int>> existing_permutations =
-        AllKPermutations(existing_agent_ids, num_other_agents);
-    std::vector<std::vector<int>> all_permutations =
-        AllKPermutations(current_agent_ids, num_other_agents);
-    // Permutations to create
-    std::vector<std::vector<int>> new_permutations;
-    std::set_difference(all_permutations.begin(), all_permutations.end(),
-                        existing_permutations.begin(),
-                        existing_permutations.end(),
-                        std::back_inserter(new_permutations));
-    for (const auto& perm : new_permutations) {
-      l.push_back(RuleState(aut_->get_init_state_number(), 0,
-                            shared_from_this(), perm));
-    }
-  } else if (!IsAgentSpecific()) {
+  if (IsAgentSpecific()) {
+    std::vector<int> existing = existing_agent_ids;
+    std::sort(existing.begin(), existing.end());
+    existing.erase(std::unique(existing.begin(), existing.end()),
+                   existing.end());
+    std::vector<int> added;
+    for (int id : new_agent_ids) {
+      if (!std::binary_search(existing.begin(), existing.end(), id)) {
+        added.push_back(id);
+      }
+    }
+    std::sort(added.begin(), added.end());
+    added.erase(std::unique(added.begin(), added.end()), added.end());
+    // Only permutations involving at least one new agent have to be created
+    ForEachNewInstance(
+        existing, added, [&](const std::vector<int>& perm) {
+          l.push_back(RuleState(compiled_->GetInitState(), 0,
+                                shared_from_this(), perm));
+          if (label_registry_) {
+            RuleState& state = l.back();
+            state.label_slots_.resize(label_bindings_.size());
+            BindAgentLabels(state.agent_ids_.data(),
+                            state.label_slots_.data());
+          }
+        });
+  } else {
     l.push_back(
-        RuleState(aut_->get_init_state_number(), 0, shared_from_this(), {}));
+        RuleState(compiled_->GetInitState(), 0, shared_from_this(), {}));
   }
+  RecordInstances(l.size());
   return l;
 }
-std::vector<std::vector<int>> RuleMonitor::AllKPermutations(
-    const std::vector<int>& values, int k) const {
-  if (values.empty()) {
-    return {};
+RuleStateSet RuleMonitor::MakeRuleStateSet(
+    const std::vector<int>& current_agent_ids) const {
+  RuleStateSet set(shared_from_this());
+  if (IsAgentSpecific()) {
+    set.AddAgents(current_agent_ids);
+  } else {
+    set.Add({});
+  }
+  return set;
+}
+
+size_t RuleMonitor::GetNumPlaceholders() const {
+  int max_placeholder_idx = -1;
+  for (const auto& ap : ap_alphabet_) {
+    max_placeholder_idx = std::max(max_placeholder_idx, ap.placeholder_idx);
+  }
+  return static_cast<size_t>(max_placeholder_idx + 1);
+}
+
+const std::vector<std::vector<int>>& RuleMonitor::GetSymmetries() const {
+  return symmetries_;
+}
+
+void RuleMonitor::SetSymmetryReduction(bool enabled) {
+  CHECK(!has_rule_states_)
+      << "Symmetry reduction of rule " << str_formula_
+      << " has to be set before creating rule states!";
+  symmetry_reduction_ = enabled;
+  ComputeFinalPenalties();
+}
+
+void RuleMonitor::RecordInstances(size_t num_instances) const {
+  has_rule_states_ = true;
+  metrics_.Add(RuleMetricsRecorder::INSTANCES, num_instances);
+}
+
+size_t RuleMonitor::GetMultiplicity() const {
+  return symmetry_reduction_ ? symmetries_.size() : 1;
+}
+
+std::vector<std::vector<int>> RuleMonitor::GetEquivalentAgentIds(
+    const std::vector<int>& agent_ids) const {
+  CHECK_EQ(agent_ids.size(), GetNumPlaceholders());
+  std::vector<std::vector<int>> equivalent;
+  for (size_t g = 0; g < GetMultiplicity(); ++g) {
+    std::vector<int> permuted(agent_ids.size());
+    for (size_t p = 0; p < agent_ids.size(); ++p) {
+      permuted[p] = agent_ids[symmetries_[g][p]];
+    }
+    equivalent.push_back(std::move(permuted));
+  }
+  return equivalent;
+}
+
+void RuleMonitor::ForEachNewInstance(
+    const std::vector<int>& existing, const std::vector<int>& added,
+    const std::function<void(const std::vector<int>&)>& callback) const {
+  if (GetMultiplicity() == 1) {
+    ForEachNewKPermutation(existing, added, GetNumPlaceholders(), callback);
+    return;
+  }
+  ForEachNewKPermutation(existing, added, GetNumPlaceholders(),
+                         [&](const std::vector<int>& perm) {
+                           if (IsCanonical(perm.data())) {
+                             callback(perm);
+                           }
+                         });
+}
+
+void RuleMonitor::ForEachNewKPermutation(
+    const std::vector<int>& existing, const std::vector<int>& added, size_t k,
+    const std::function<void(const std::vector<int>&)>& callback) {
+  if (added.empty() || existing.size() + added.size() < k) {
+    return;
   }
-  std::vector<std::vector<int>> permutations;
-  std::vector<int> value_permutation(k, 0);
-  std::vector<int> idx_permutation(values.size());
-  std::iota(idx_permutation.begin(), idx_permutation.end(), 0);
-  // Create all k-permutations of the agent ids
-  do {
-    for (int i = 0; i < k; i++) {
-      value_permutation[i] = values[idx_permutation[i]];
+  std::vector<int> values;
+  std::merge(existing.begin(), existing.end(), added.begin(), added.end(),
+             std::back_inserter(values));
+  std::vector<bool> is_new(values.size());
+  for (size_t i = 0; i < values.size(); ++i) {
+    is_new[i] = std::binary_search(added.begin(), added.end(), values[i]);
+  }
+  std::vector<bool> used(values.size(), false);
+  std::vector<int> permutation(k);
+  // Depth first search in lexicographic order. The last position is forced
+  // to a new agent if none has been placed so far, so the number of visited
+  // nodes is bounded by the number of created permutations.
+  std::function<void(size_t, bool)> place = [&](size_t pos, bool has_new) {
+    if (pos == k) {
+      callback(permutation);
+      return;
+    }
+    const bool needs_new = !has_new && pos + 1 == k;
+    for (size_t i = 0; i < values.size(); ++i) {
+      if (used[i] || (needs_new && !is_new[i])) {
+        continue;
+      }
+      used[i] = true;
+      permutation[pos] = values[i];
+      place(pos + 1, has_new || is_new[i]);
+      used[i] = false;
     }
-    permutations.emplace_back(value_permutation);
-    std::reverse(idx_permutation.begin() + k, idx_permutation.end());
-  } while (
-      std::next_permutation(idx_permutation.begin(), idx_permutation.end()));
-  return permutations;
+  };
+  place(0, false);
 }
 
 double RuleMonitor::Evaluate(const EvaluationMap& labels,
                             RuleState& state) const {
-#ifdef PROFILING
+#ifdef BUILD_WITH_EASY_PROFILER
   EASY_FUNCTION();
 #endif
+  RuleMetricsRecorder::ScopedTimer timer(metrics_);
 
-  EvaluationMap alive_labels = labels;
-  alive_labels.insert({Label::MakeAlive(), true});
-  return Transit(alive_labels, state);
+  const bool alive = IsAlive(labels);
+  if (alive && IsDecided(state.current_state_)) {
+    return 0.0;
+  }
+  CompiledAutomaton::APMask known = 0;
+  CompiledAutomaton::APMask values = 0;
+  ResolveLabels(labels, alive, false, state.agent_ids_.data(), &known,
+                &values);
+  ResolveLabels(labels, alive, true, state.agent_ids_.data(), &known, &values);
+  return TransitInstance(known, values, alive, state.agent_ids_.data(),
+                         &state.current_state_, &state.violated_);
 }
 
-double RuleMonitor::Transit(const EvaluationMap& labels,
-                           RuleState& state) const {
-  std::map<int, bool> bddvars;
-  spot::bdd_dict_ptr bddDictPtr = aut_->get_dict();
-  for (const auto& ap : ap_alphabet_) {
+void RuleMonitor::EvaluateBatch(const EvaluationMap& labels, RuleState* states,
+                                size_t num_states, double* penalties) const {
+  RuleMetricsRecorder::ScopedTimer timer(metrics_);
+  const bool alive = IsAlive(labels);
+  CompiledAutomaton::APMask shared_known = 0;
+  CompiledAutomaton::APMask shared_values = 0;
+  ResolveLabels(labels, alive, false, nullptr, &shared_known, &shared_values);
+  for (size_t i = 0; i < num_states; ++i) {
+    penalties[i] = EvaluateResolved(labels, alive, shared_known,
+                                    shared_values, states[i]);
+  }
+}
+
+void RuleMonitor::EvaluateBatch(const EvaluationMap& labels,
+                                RuleState* const* states, size_t num_states,
+                                double* penalties) const {
+  RuleMetricsRecorder::ScopedTimer timer(metrics_);
+  const bool alive = IsAlive(labels);
+  CompiledAutomaton::APMask shared_known = 0;
+  CompiledAutomaton::APMask shared_values = 0;
+  ResolveLabels(labels, alive, false, nullptr, &shared_known, &shared_values);
+  for (size_t i = 0; i < num_states; ++i) {
+    penalties[i] = EvaluateResolved(labels, alive, shared_known,
+                                    shared_values, *states[i]);
+  }
+}
+
+double RuleMonitor::EvaluateResolved(const EvaluationMap& labels, bool alive,
+                                     CompiledAutomaton::APMask shared_known,
+                                     CompiledAutomaton::APMask shared_values,
+                                     RuleState& state) const {
+  DCHECK(state.automaton_.get() == this);
+  if (alive && IsDecided(state.current_state_)) {
+    return 0.0;
+  }
+  CompiledAutomaton::APMask known = shared_known;
+  CompiledAutomaton::APMask values = shared_values;
+  if (rule_is_agent_specific_) {
+    ResolveLabels(labels, alive, true, state.agent_ids_.data(), &known,
+                  &values);
+  }
+  return TransitInstance(known, values, alive, state.agent_ids_.data(),
+                         &state.current_state_, &state.violated_);
+}
+
+std::vector<double> RuleMonitor::EvaluateBatch(
+    const EvaluationMap& labels, std::vector<RuleState>& states) const {
+  std::vector<double> penalties(states.size());
+  EvaluateBatch(labels, states.data(), states.size(), penalties.data());
+  return penalties;
+}
+
+void RuleMonitor::BindLabels(const std::shared_ptr<LabelRegistry>& registry) {
+  label_registry_ = registry;
+  for (auto& binding : label_bindings_) {
+    const APContainer& ap = ap_alphabet_[binding.ap_idx];
+    if (ap.is_agent_specific) {
+      binding.agent_label_idx = label_registry_->RegisterAgentLabel(ap.ap_str);
+    } else {
+      binding.slot = label_registry_->Register(Label(ap.ap_str));
+    }
+  }
+}
+
+const std::shared_ptr<LabelRegistry>& RuleMonitor::GetLabelRegistry() const {
+  return label_registry_;
+}
+
+void RuleMonitor::BindAgentLabels(const int* agent_ids,
+                                  int* label_slots) const {
+  for (size_t i = 0; i < label_bindings_.size(); ++i) {
+    const LabelBinding& binding = label_bindings_[i];
+    const APContainer& ap = ap_alphabet_[binding.ap_idx];
+    label_slots[i] =
+        ap.is_agent_specific
+            ? label_registry_->Register(
+                  binding.agent_label_idx,
+                  label_registry_->RegisterAgent(agent_ids[ap.placeholder_idx]))
+            : -1;
+  }
+}
+
+double RuleMonitor::Evaluate(const LabelFrame& labels,
+                             RuleState& state) const {
+  RuleMetricsRecorder::ScopedTimer timer(metrics_);
+  CheckBound(state.label_slots_.size() == label_bindings_.size());
+  if (IsDecided(state.current_state_)) {
+    return 0.0;
+  }
+  CompiledAutomaton::APMask known = alive_mask_;
+  CompiledAutomaton::APMask values = alive_mask_;
+  ResolveLabels(labels, false, nullptr, &known, &values);
+  ResolveLabels(labels, true, state.label_slots_.data(), &known, &values);
+  return TransitInstance(known, values, true, state.agent_ids_.data(),
+                         &state.current_state_, &state.violated_);
+}
+
+void RuleMonitor::EvaluateBatch(const LabelFrame& labels, RuleState* states,
+                                size_t num_states, double* penalties) const {
+  RuleMetricsRecorder::ScopedTimer timer(metrics_);
+  CompiledAutomaton::APMask shared_known = alive_mask_;
+  CompiledAutomaton::APMask shared_values = alive_mask_;
+  ResolveLabels(labels, false, nullptr, &shared_known, &shared_values);
+  for (size_t i = 0; i < num_states; ++i) {
+    RuleState& state = states[i];
+    DCHECK(state.automaton_.get() == this);
+    CheckBound(state.label_slots_.size() == label_bindings_.size());
+    if (IsDecided(state.current_state_)) {
+      penalties[i] = 0.0;
+      continue;
+    }
+    CompiledAutomaton::APMask known = shared_known;
+    CompiledAutomaton::APMask values = shared_values;
+    if (rule_is_agent_specific_) {
+      ResolveLabels(labels, true, state.label_slots_.data(), &known, &values);
+    }
+    penalties[i] =
+        TransitInstance(known, values, true, state.agent_ids_.data(),
+                        &state.current_state_, &state.violated_);
+  }
+}
+
+std::vector<double> RuleMonitor::EvaluateBatch(
+    const LabelFrame& labels, std::vector<RuleState>& states) const {
+  std::vector<double> penalties(states.size());
+  EvaluateBatch(labels, states.data(), states.size(), penalties.data());
+  return penalties;
+}
+
+bool RuleMonitor::IsAlive(const EvaluationMap& labels) {
+  // Labels passed by the caller take precedence over the implicit alive label
+  auto it = labels.find(Label::MakeAlive());
+  return it == labels.end() || it->second;
+}
+
+void RuleMonitor::ResolveLabels(const EvaluationMap& labels, bool alive,
+                                bool agent_specific, const int* agent_ids,
+                                CompiledAutomaton::APMask* known,
+                                CompiledAutomaton::APMask* values) const {
+  if (!agent_specific) {
+    *known |= alive_mask_;
+    if (alive) {
+      *values |= alive_mask_;
+    }
+  }
+  for (const auto& binding : label_bindings_) {
+    const APContainer& ap = ap_alphabet_[binding.ap_idx];
+    if (ap.is_agent_specific != agent_specific) {
+      continue;
+    }
     Label label;
     if (ap.is_agent_specific) {
-      label = Label(ap.ap_str, state.GetAgentIds()[ap.placeholder_idx]);
+      label = Label(ap.ap_str, agent_ids[ap.placeholder_idx]);
     } else {
       label = Label(ap.ap_str);
     }
     auto it = labels.find(label);
     if (it != labels.end()) {
-      int bdd_var = bddDictPtr->has_registered_proposition(ap.ap, aut_);
-      bddvars.insert({bdd_var, it->second});
-    } else if (labels.at(Label::MakeAlive())) {
+      *known |= binding.bit;
+      if (it->second) {
+        *values |= binding.bit;
+      }
+    } else if (alive) {
       // We ware alive but the label is undefined
       LOG(FATAL) << "Rule " << str_formula_ << " undefined! Missing label \""
                  << ap.ap_str << "\"! Aborting!";
     }
   }
+}
 
-  BddResult transition_found = BddResult::FALSE;
-  // Indicates if we have found undefined transitions
-  bool undef_trans_found = false;
-  for (const auto& transition : aut_->out(state.current_state_)) {
-    transition_found = EvaluateBdd(transition.cond, bddvars);
-    if (transition_found == BddResult::TRUE) {
-      state.current_state_ = transition.dst;
-      break;
+void RuleMonitor::ResolveLabels(const LabelFrame& labels, bool agent_specific,
+                                const int* label_slots,
+                                CompiledAutomaton::APMask* known,
+                                CompiledAutomaton::APMask* values) const {
+  for (size_t i = 0; i < label_bindings_.size(); ++i) {
+    const LabelBinding& binding = label_bindings_[i];
+    if ((binding.slot < 0) != agent_specific) {
+      continue;
+    }
+    const int slot = agent_specific ? label_slots[i] : binding.slot;
+    if (!labels.IsDefined(slot)) {
+      LOG(FATAL) << "Rule " << str_formula_ << " undefined! Missing label \""
+                 << ap_alphabet_[binding.ap_idx].ap_str << "\"! Aborting!";
     }
-    if (transition_found == BddResult::UNDEF) {
-      undef_trans_found = true;
+    *known |= binding.bit;
+    if (labels.Get(slot)) {
+      *values |= binding.bit;
     }
   }
+}
+
+CompiledAutomaton::APMask RuleMonitor::ChangedAPs(
+    const LabelFrame& labels, bool agent_specific,
+    const int* label_slots) const {
+  CompiledAutomaton::APMask changed = 0;
+  for (size_t i = 0; i < label_bindings_.size(); ++i) {
+    const LabelBinding& binding = label_bindings_[i];
+    if ((binding.slot < 0) != agent_specific) {
+      continue;
+    }
+    const int slot = agent_specific ? label_slots[i] : binding.slot;
+    if (static_cast<size_t>(slot) < labels.GetNumSlots() &&
+        labels.HasChanged(slot)) {
+      changed |= binding.bit;
+    }
+  }
+  return changed;
+}
+
+void RuleMonitor::CheckBound(bool state_is_bound) const {
+  CHECK(label_registry_) << "Rule " << str_formula_ << " has no bound labels!";
+  CHECK(!rule_is_agent_specific_ || state_is_bound)
+      << "Rule state has been created before binding labels!";
+}
+
+double RuleMonitor::Transit(CompiledAutomaton::APMask known,
+                            CompiledAutomaton::APMask values, bool alive,
+                            uint32_t* current_state, size_t* violated) const {
+  const uint32_t state = *current_state;
+  bool undefined;
+  const bool is_violated =
+      Advance(known, values, alive, current_state, &undefined);
+  RecordStep(state, *current_state, undefined, is_violated);
+  if (!is_violated) {
+    return 0.0;
+  }
+  ++*violated;
+  return instance_weight_;
+}
 
-  double penalty = 0.0f;
-  if ((transition_found == BddResult::FALSE && !undef_trans_found) ||
-      (transition_found != BddResult::TRUE && !labels.at(Label::MakeAlive()))) {
-    ++state.violated_;
+bool RuleMonitor::Advance(CompiledAutomaton::APMask known,
+                          CompiledAutomaton::APMask values, bool alive,
+                          uint32_t* current_state, bool* undefined) const {
+  uint32_t next_state;
+  const CompiledAutomaton::StepResult transition_found =
+      compiled_->Step(*current_state, known, values, &next_state);
+  *undefined = transition_found == CompiledAutomaton::UNDEF;
+  if (transition_found == CompiledAutomaton::TRUE) {
+    *current_state = next_state;
+    return false;
+  }
+  if (transition_found == CompiledAutomaton::FALSE || !alive) {
     // Reset automaton if rule has been violated
-    state.current_state_ = aut_->get_init_state_number();
-    penalty = weight_;
-  } else if (transition_found != BddResult::TRUE && undef_trans_found) {
-    LOG(FATAL) << "Rule " << str_formula_ << " undefined!";
+    *current_state = compiled_->GetInitState();
+    return true;
+  }
+  LOG(FATAL) << "Rule " << str_formula_ << " undefined!";
+  return false;
+}
+
+void RuleMonitor::RecordStep(uint32_t state, uint32_t next_state,
+                             bool undefined, bool violated) const {
+  metrics_.Add(RuleMetricsRecorder::STEPS);
+  if (undefined) {
+    metrics_.Add(RuleMetricsRecorder::UNDEFINED);
+  }
+  if (violated) {
+    metrics_.Add(RuleMetricsRecorder::VIOLATIONS);
+    if (state != compiled_->GetInitState()) {
+      metrics_.Add(RuleMetricsRecorder::RESETS);
+    }
+  } else if (next_state != state) {
+    metrics_.Add(RuleMetricsRecorder::TRANSITIONS);
   }
-  return penalty;
 }
 
-RuleMonitor::BddResult RuleMonitor::EvaluateBdd(
-    bdd cond, const std::map<int, bool>& vars) {
-  bdd bdd_node = cond;
-  while (bdd_node != bddtrue && bdd_node != bddfalse) {
-    auto it = vars.find(bdd_var(bdd_node));
-    if (it != vars.end()) {
-      bdd_node = it->second ? bdd_high(bdd_node) : bdd_low(bdd_node);
+void RuleMonitor::LogViolation(uint32_t state, const int* agent_ids,
+                               int64_t step) const {
+  if (!violation_log_) {
+    return;
+  }
+  ViolationRecord record;
+  record.rule_id = violation_rule_id_;
+  record.automaton_state = state;
+  const size_t arity = GetNumPlaceholders();
+  // One record per represented agent tuple
+  for (size_t g = 0; g < GetMultiplicity(); ++g) {
+    for (size_t i = 0; i < ViolationRecord::kMaxArity; ++i) {
+      record.agent_ids[i] = i < arity ? agent_ids[symmetries_[g][i]] : -1;
+    }
+    if (step < 0) {
+      violation_log_->Push(record);
     } else {
-      // Undefined AP
-      return BddResult::UNDEF;
+      violation_log_->Push(record, step);
     }
   }
-  return bdd_node == bddtrue ? BddResult::TRUE : BddResult::FALSE;
 }
 
-double RuleMonitor::FinalTransit(const RuleState& state) const {
-  double penalty = 0.0f;
-  EvaluationMap not_alive;
-  not_alive.insert({Label::MakeAlive(), false});
-  RuleState final_state = state;
-  Transit(not_alive, final_state);
-  if (!aut_->state_is_accepting(final_state.current_state_)) {
-    penalty = weight_;
+double RuleMonitor::TransitInstance(CompiledAutomaton::APMask known,
+                                    CompiledAutomaton::APMask values,
+                                    bool alive, const int* agent_ids,
+                                    uint32_t* current_state,
+                                    size_t* violated, int64_t step) const {
+  const uint32_t state = *current_state;
+  const size_t num_violations = *violated;
+  const double penalty =
+      Transit(known, values, alive, current_state, violated);
+  if (*violated != num_violations) {
+    LogViolation(state, agent_ids, step);
   }
   return penalty;
 }
 
+double RuleMonitor::FinalTransit(const RuleState& state) const {
+  return FinalPenalty(state.current_state_);
+}
+
+double RuleMonitor::FinalPenalty(uint32_t current_state) const {
+  return final_penalties_[current_state];
+}
+
+RuleMonitor::Verdict RuleMonitor::GetVerdict(uint32_t automaton_state) const {
+  if (!IsDecided(automaton_state)) {
+    return UNDECIDED;
+  }
+  return final_penalties_[automaton_state] == 0.0 ? SATISFIED : VIOLATED;
+}
+
 std::ostream& operator<<(std::ostream& os, RuleMonitor const& d) {
-  os << "\"";
-  spot::print_psl(os, d.ltl_formula_);
-  os << "\", weight: " << d.weight_ << ", priority: " << d.priority_;
+  os << "\"" << d.automaton_->formula_str << "\", weight: " << d.weight_
+     << ", priority: " << d.priority_;
   return os;
 }
 
-spot::formula RuleMonitor::ParseFormula(const std::string& ltl_formula_str) {
-  spot::parsed_formula pf = spot::parse_infix_psl(ltl_formula_str);
-  if (!pf.errors.empty()) {
-    pf.format_errors(LOG(FATAL));
-  }
-  return pf.f;
+void RuleMonitor::SetViolationLog(const std::shared_ptr<ViolationLog>& log,
+                                  uint32_t rule_id) {
+  CHECK(!log || GetNumPlaceholders() <= ViolationRecord::kMaxArity)
+      << "Rule " << str_formula_
+      << " has too many placeholders for the violation log!";
+  violation_log_ = log;
+  violation_rule_id_ = rule_id;
+}
+
+RuleMetrics RuleMonitor::GetMetrics() const { return metrics_.Get(); }
+void RuleMonitor::ResetMetrics() { metrics_.Reset(); }
+void RuleMonitor::SetLatencyTracking(bool enabled) {
+  metrics_.SetLatencyTracking(enabled);
 }
 
 RulePriority RuleMonitor::GetPriority() const { return priority_; }
@@ -257,14 +911,20 @@ double RuleMonitor::GetWeight() const { return weight_; }
 void RuleMonitor::PrintToDot(const std::string& fname) {
   std::ofstream os;
   os.open(fname);
-  spot::print_dot(os, aut_);
+  if (!automaton_->aut) {
+    // Deserialized rules have no Spot automaton
+    automaton_ = AutomatonCache::GetInstance().Get(agent_free_formula_);
+  }
+  {
+    auto spot_lock = AutomatonCache::LockSpot();
+    spot::print_dot(os, automaton_->aut);
+  }
   os.close();
 }
 
 bool RuleMonitor::APContainer::operator==(
     const RuleMonitor::APContainer& rhs) const {
-  return ap_str == rhs.ap_str && ap == rhs.ap &&
-         placeholder_idx == rhs.placeholder_idx &&
+  return ap_str == rhs.ap_str && placeholder_idx == rhs.placeholder_idx &&
          is_agent_specific == rhs.is_agent_specific;
 }
 bool RuleMonitor::APContainer::operator!=(
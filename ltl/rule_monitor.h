@@ -6,6 +6,8 @@
 #ifndef LTL_RULE_MONITOR_H_
 #define LTL_RULE_MONITOR_H_
 
+#include <atomic>
+#include <functional>
 #include <map>
 #include <memory>
 #include <set>
@@ -15,21 +17,31 @@
 
 #include "Eigen/Core"
 #include "bark/world/evaluation/ltl/label/label.h"
+#include "ltl/automaton_cache.h"
 #include "ltl/common.h"
+#include "ltl/compiled_automaton.h"
+#include "ltl/label_frame.h"
+#include "ltl/rule_metrics.h"
 #include "ltl/rule_state.h"
-#include "spot/tl/parse.hh"
-#include "spot/twaalgos/translate.hh"
+#include "ltl/rule_state_set.h"
+#include "ltl/violation_log.h"
 
 namespace ltl {
 using bark::world::evaluation::EvaluationMap;
 using bark::world::evaluation::Label;
 
+class ProductMonitor;
 class RuleState;
+class RuleStateSet;
 
 class RuleMonitor : public std::enable_shared_from_this<RuleMonitor> {
  public:
   typedef std::shared_ptr<RuleMonitor> RuleMonitorSPtr;
 
+  /// Outcome of an automaton state that no step can change while the agents
+  /// are alive. Rule states in a decided state are not evaluated anymore.
+  enum Verdict { UNDECIDED, SATISFIED, VIOLATED };
+
   static RuleMonitorSPtr MakeRule(std::string ltl_formula_str, double weight,
                                   RulePriority priority) {
     return RuleMonitorSPtr(new RuleMonitor(ltl_formula_str, weight, priority));
@@ -39,55 +51,233 @@ class RuleMonitor : public std::enable_shared_from_this<RuleMonitor> {
       const std::vector<int>& current_agent_ids = {},
       const std::vector<int>& existing_agent_ids = {}) const;
 
+  /// Create a set holding the same rule states as MakeRuleState.
+  RuleStateSet MakeRuleStateSet(
+      const std::vector<int>& current_agent_ids = {}) const;
+
   double Evaluate(const EvaluationMap& labels, RuleState& state) const;
 
+  /// Registers the labels of this rule in registry. Rule states created
+  /// afterwards are bound to the registry and can be evaluated on frames.
+  void BindLabels(const std::shared_ptr<LabelRegistry>& registry);
+  /// Registry passed to BindLabels, nullptr if the labels are not bound.
+  const std::shared_ptr<LabelRegistry>& GetLabelRegistry() const;
+
+  /// Evaluate on a dense frame of the registry passed to BindLabels.
+  double Evaluate(const LabelFrame& labels, RuleState& state) const;
+
+  /// Advance all states of this rule on the same labels. Labels that are not
+  /// agent specific are resolved only once for the whole batch.
+  /// \param penalties Output, one penalty per state
+  void EvaluateBatch(const EvaluationMap& labels, RuleState* states,
+                     size_t num_states, double* penalties) const;
+  /// Same as above for states that are not stored contiguously.
+  void EvaluateBatch(const EvaluationMap& labels, RuleState* const* states,
+                     size_t num_states, double* penalties) const;
+  std::vector<double> EvaluateBatch(const EvaluationMap& labels,
+                                    std::vector<RuleState>& states) const;
+  void EvaluateBatch(const LabelFrame& labels, RuleState* states,
+                     size_t num_states, double* penalties) const;
+  std::vector<double> EvaluateBatch(const LabelFrame& labels,
+                                    std::vector<RuleState>& states) const;
+
   double FinalTransit(const RuleState& state) const;
 
+  /// SATISFIED or VIOLATED if automaton_state is stable, depending on the
+  /// penalty FinalTransit would yield in it.
+  Verdict GetVerdict(uint32_t automaton_state) const;
+
+  /// Record every violation of a rule state of this rule in log, nullptr to
+  /// stop recording. Not thread-safe, call before evaluating.
+  /// \param rule_id Id stored in the records of this rule
+  void SetViolationLog(const std::shared_ptr<ViolationLog>& log,
+                       uint32_t rule_id);
+
+  /// Counters of this rule summed over all threads.
+  RuleMetrics GetMetrics() const;
+  void ResetMetrics();
+  /// Record the duration of evaluation calls in the latency histogram.
+  void SetLatencyTracking(bool enabled);
+
   RulePriority GetPriority() const;
 
   bool IsAgentSpecific() const;
 
+  /// Number of distinct agent placeholders, i.e. the length of agent tuples.
+  size_t GetNumPlaceholders() const;
+
+  /// Permutations of the placeholders which leave the rule unchanged,
+  /// starting with the identity. Placeholder p is replaced by perm[p].
+  const std::vector<std::vector<int>>& GetSymmetries() const;
+  /// If enabled, agent tuples that are equivalent under a symmetry are
+  /// instantiated only once, for the lexicographically smallest tuple. Its
+  /// penalties and violation records account for all tuples it represents,
+  /// its violation count does not. Disabled by default, since per-state
+  /// results then no longer belong to a single tuple. Must be called before
+  /// any rule state of this rule is created and not concurrently with other
+  /// uses of the rule.
+  void SetSymmetryReduction(bool enabled);
+  /// Number of agent tuples represented by one rule state.
+  size_t GetMultiplicity() const;
+  /// Agent tuples represented by the rule state of agent_ids, starting with
+  /// agent_ids itself.
+  std::vector<std::vector<int>> GetEquivalentAgentIds(
+      const std::vector<int>& agent_ids) const;
+
   friend std::ostream& operator<<(std::ostream& os, RuleMonitor const& d);
   const std::string& GetStrFormula() const;
   double GetWeight() const;
   void PrintToDot(const std::string& fname);
 
+  /// Agent placeholders like a#0 have to be smaller.
+  static constexpr int32_t kMaxPlaceholders = 100000;
+
+  /// Compact binary representation of the compiled rule.
+  std::string Serialize() const;
+  /// Restore a rule written by Serialize, without invoking Spot. The data
+  /// may be memory-mapped, it is not referenced after returning.
+  /// Corrupt data throws std::invalid_argument.
+  static RuleMonitorSPtr Deserialize(const char* data, size_t size);
+  static RuleMonitorSPtr Deserialize(const std::string& data);
+  /// Restore a rule whose automaton tables remain in data, e.g. in a shared
+  /// memory segment. storage has to keep data alive.
+  static RuleMonitorSPtr Deserialize(
+      const char* data, size_t size,
+      const std::shared_ptr<const void>& storage);
+
  private:
-  enum BddResult { TRUE, FALSE, UNDEF };
+  friend class ProductMonitor;
+  friend class RuleStateArena;
+  friend class RuleStateSet;
 
-  static spot::formula ParseFormula(const std::string& ltl_formula_str);
-  static BddResult EvaluateBdd(bdd cond, const std::map<int, bool>& vars);
+  static constexpr uint32_t kSerializationMagic = 0x4d4c544c;  // "LTLM"
+  static constexpr uint32_t kSerializationVersion = 3;
+  // Symmetries of rules with more placeholders are not searched
+  static constexpr size_t kMaxSymmetryPlaceholders = 4;
 
   RuleMonitor(const std::string& ltl_formula_str, double weight,
               RulePriority priority);
+  RuleMonitor(BinaryReader* reader,
+              const std::shared_ptr<const void>& storage);
+  void InitLabelBindings();
+  void ClassifyStates();
+  void ComputeFinalPenalties();
+  /// Count created rule states in the metrics.
+  void RecordInstances(size_t num_instances) const;
+  void DetectSymmetries();
+  /// True if renaming the placeholders by placeholder_perm yields an
+  /// automaton which is bisimilar to the original one.
+  bool IsSymmetry(const std::vector<int>& placeholder_perm) const;
+  /// True if no symmetry maps agent_ids to a smaller tuple.
+  bool IsCanonical(const int* agent_ids) const;
+  /// True if evaluating state while alive never changes it and yields no
+  /// penalty. Labels are neither resolved nor checked for such states.
+  bool IsDecided(uint32_t state) const { return decided_states_[state]; }
+  /// Builds the AP alphabet and returns the formula without placeholders.
   std::string ParseAgents(const std::string& ltl_formula_str);
-  std::vector<std::vector<int>> AllKPermutations(const std::vector<int>& values,
-                                                 int k) const;
-  double Transit(const EvaluationMap& labels, RuleState& state) const;
+  /// Names the automaton AP of every AP. A label used with several
+  /// placeholders, e.g. a#0 and a#1, must map to one automaton AP per
+  /// placeholder, which is named "a#<placeholder>" and quoted in the formula.
+  /// Other APs keep their label name.
+  void AssignAutomatonAPs();
+  /// Calls callback for all k-permutations of existing and added agent ids
+  /// which contain at least one added id. Inputs must be sorted and disjoint.
+  static void ForEachNewKPermutation(
+      const std::vector<int>& existing, const std::vector<int>& added, size_t k,
+      const std::function<void(const std::vector<int>&)>& callback);
+  /// ForEachNewKPermutation over the agent tuples which need a rule state.
+  void ForEachNewInstance(
+      const std::vector<int>& existing, const std::vector<int>& added,
+      const std::function<void(const std::vector<int>&)>& callback) const;
+  static bool IsAlive(const EvaluationMap& labels);
+  void ResolveLabels(const EvaluationMap& labels, bool alive,
+                     bool agent_specific, const int* agent_ids,
+                     CompiledAutomaton::APMask* known,
+                     CompiledAutomaton::APMask* values) const;
+  void ResolveLabels(const LabelFrame& labels, bool agent_specific,
+                     const int* label_slots, CompiledAutomaton::APMask* known,
+                     CompiledAutomaton::APMask* values) const;
+  /// APs whose labels are marked as changed in labels.
+  CompiledAutomaton::APMask ChangedAPs(const LabelFrame& labels,
+                                       bool agent_specific,
+                                       const int* label_slots) const;
+  void CheckBound(bool state_is_bound) const;
+  /// Evaluate of one state of a batch whose shared labels are resolved.
+  double EvaluateResolved(const EvaluationMap& labels, bool alive,
+                          CompiledAutomaton::APMask shared_known,
+                          CompiledAutomaton::APMask shared_values,
+                          RuleState& state) const;
+  double Transit(CompiledAutomaton::APMask known,
+                 CompiledAutomaton::APMask values, bool alive,
+                 uint32_t* current_state, size_t* violated) const;
+  /// Step of Transit without recording metrics, returns whether the rule is
+  /// violated.
+  bool Advance(CompiledAutomaton::APMask known,
+               CompiledAutomaton::APMask values, bool alive,
+               uint32_t* current_state, bool* undefined) const;
+  /// Records the metrics of a step from state to next_state.
+  void RecordStep(uint32_t state, uint32_t next_state, bool undefined,
+                  bool violated) const;
+  /// Logs a violation in state, if a violation log is set.
+  /// \param agent_ids Agent tuple of the rule state, unused without
+  /// placeholders
+  void LogViolation(uint32_t state, const int* agent_ids, int64_t step) const;
+  /// Transit of a rule state which records violations in the log.
+  /// \param agent_ids Agent tuple of the rule state
+  /// \param step Step of logged violations, -1 for the step of the log
+  double TransitInstance(CompiledAutomaton::APMask known,
+                         CompiledAutomaton::APMask values, bool alive,
+                         const int* agent_ids, uint32_t* current_state,
+                         size_t* violated, int64_t step = -1) const;
+  double FinalPenalty(uint32_t current_state) const;
+  void BindAgentLabels(const int* agent_ids, int* label_slots) const;
 
   struct APContainer {
     bool operator==(const APContainer& rhs) const;
     bool operator!=(const APContainer& rhs) const;
     std::string ap_str;
-    spot::formula ap;
     int placeholder_idx;
     bool is_agent_specific;
+    // Index into the APs of the compiled automaton, -1 if unused
+    int compiled_idx;
+    // Name of the AP in the agent-free formula
+    std::string automaton_ap;
   };
 
-  struct APContainerHash {
-   public:
-    size_t operator()(const APContainer& apcont) const {
-      return std::hash<std::string>()(apcont.ap_str);
-    }
+  // Binding of the rule's labels, except alive, to slots of a LabelRegistry
+  struct LabelBinding {
+    int ap_idx;
+    // -1 for agent specific APs, these are bound per rule state
+    int slot;
+    CompiledAutomaton::APMask bit;
+    // Name index of agent specific APs in the registry, -1 otherwise
+    int agent_label_idx;
   };
 
   std::string str_formula_;
+  std::string agent_free_formula_;
   double weight_;
-  spot::twa_graph_ptr aut_;
-  spot::formula ltl_formula_;
+  // Shared with all rules of the same formula, see AutomatonCache
+  AutomatonCache::TranslatedAutomatonPtr automaton_;
+  std::shared_ptr<const CompiledAutomaton> compiled_;
   RulePriority priority_;
-  std::unordered_set<APContainer, APContainerHash> ap_alphabet_;
+  std::vector<APContainer> ap_alphabet_;
+  std::vector<LabelBinding> label_bindings_;
+  CompiledAutomaton::APMask alive_mask_;
+  std::vector<uint8_t> decided_states_;
+  // Penalty of FinalTransit per automaton state
+  std::vector<double> final_penalties_;
+  std::vector<std::vector<int>> symmetries_;
+  bool symmetry_reduction_ = false;
+  // Set once the first rule state has been created
+  mutable std::atomic<bool> has_rule_states_{false};
+  // Penalty of a violation of one rule state, see GetMultiplicity
+  double instance_weight_;
+  std::shared_ptr<LabelRegistry> label_registry_;
   bool rule_is_agent_specific_;
+  mutable RuleMetricsRecorder metrics_;
+  std::shared_ptr<ViolationLog> violation_log_;
+  uint32_t violation_rule_id_ = 0;
 };
 }  // namespace ltl
 
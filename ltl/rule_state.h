@@ -20,6 +20,7 @@ class RuleMonitor;
 class RuleState {
  public:
   friend class RuleMonitor;
+  friend class RuleStateSet;
   uint32_t GetCurrentState() const;
   RulePriority GetPriority() const;
   size_t GetViolationCount() const;
@@ -37,6 +38,8 @@ class RuleState {
   size_t violated_;
   std::shared_ptr<const RuleMonitor> automaton_;
   std::vector<int> agent_ids_;
+  // Registry slots of the agent specific labels, see RuleMonitor::BindLabels
+  std::vector<int> label_slots_;
 };
 
 }  // namespace ltl
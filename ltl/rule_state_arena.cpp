@@ -0,0 +1,163 @@
+// Copyright (c) 2020 Klemens Esterle, Luis Gressenbuch
+//
+// This work is licensed under the terms of the MIT license.
+// For a copy, see <https://opensource.org/licenses/MIT>.
+
+#include "ltl/rule_state_arena.h"
+
+#include <algorithm>
+
+#include "glog/logging.h"
+#include "ltl/rule_monitor.h"
+
+namespace ltl {
+
+RuleStateArena::RuleStateArena(size_t capacity) { entries_.reserve(capacity); }
+
+RuleStateArena::Handle RuleStateArena::Add(const RuleMonitor& rule,
+                                           const int* agent_ids) {
+  const size_t arity = rule.GetNumPlaceholders();
+  CHECK_LE(arity, kMaxArity) << "Rule " << rule.GetStrFormula()
+                             << " has too many placeholders for the arena!";
+  CHECK(agent_ids || arity == 0)
+      << "Rule " << rule.GetStrFormula() << " needs an agent tuple!";
+  Entry entry{};
+  entry.rule = &rule;
+  entry.current_state = rule.compiled_->GetInitState();
+  entry.label_slots_begin = kUnbound;
+  entry.violations = 0;
+  std::copy_n(agent_ids, arity, entry.agent_ids);
+  if (rule.label_registry_ && rule.IsAgentSpecific()) {
+    entry.label_slots_begin = label_slots_.size();
+    label_slots_.resize(label_slots_.size() + rule.label_bindings_.size());
+    rule.BindAgentLabels(entry.agent_ids,
+                         &label_slots_[entry.label_slots_begin]);
+  }
+  entries_.push_back(entry);
+  rule.RecordInstances(1);
+  return entries_.size() - 1;
+}
+
+size_t RuleStateArena::AddAgents(const RuleMonitor& rule,
+                                 const std::vector<int>& agent_ids) {
+  if (!rule.IsAgentSpecific()) {
+    Add(rule);
+    return 1;
+  }
+  std::vector<int> added = agent_ids;
+  std::sort(added.begin(), added.end());
+  added.erase(std::unique(added.begin(), added.end()), added.end());
+  const size_t begin = Size();
+  rule.ForEachNewInstance(
+      {}, added, [&](const std::vector<int>& perm) { Add(rule, perm.data()); });
+  return Size() - begin;
+}
+
+void RuleStateArena::Reset() {
+  entries_.clear();
+  label_slots_.clear();
+}
+
+double RuleStateArena::Evaluate(const EvaluationMap& labels, Handle handle) {
+  return Evaluate(labels, handle, handle + 1, nullptr);
+}
+
+double RuleStateArena::Evaluate(const LabelFrame& labels, Handle handle) {
+  return Evaluate(labels, handle, handle + 1, nullptr);
+}
+
+double RuleStateArena::Evaluate(const EvaluationMap& labels, Handle begin,
+                                Handle end, double* penalties) {
+  DCHECK_LE(end, Size());
+  const bool alive = RuleMonitor::IsAlive(labels);
+  const RuleMonitor* rule = nullptr;
+  CompiledAutomaton::APMask shared_known = 0;
+  CompiledAutomaton::APMask shared_values = 0;
+  double sum = 0.0;
+  for (Handle h = begin; h < end; ++h) {
+    Entry& entry = entries_[h];
+    if (entry.rule != rule) {
+      rule = entry.rule;
+      shared_known = 0;
+      shared_values = 0;
+      rule->ResolveLabels(labels, alive, false, nullptr, &shared_known,
+                          &shared_values);
+    }
+    double penalty = 0.0;
+    if (!alive || !rule->IsDecided(entry.current_state)) {
+      CompiledAutomaton::APMask known = shared_known;
+      CompiledAutomaton::APMask values = shared_values;
+      if (rule->rule_is_agent_specific_) {
+        rule->ResolveLabels(labels, alive, true, entry.agent_ids, &known,
+                            &values);
+      }
+      penalty = rule->TransitInstance(known, values, alive, entry.agent_ids,
+                                      &entry.current_state, &entry.violations);
+    }
+    if (penalties) {
+      penalties[h - begin] = penalty;
+    }
+    sum += penalty;
+  }
+  return sum;
+}
+
+double RuleStateArena::Evaluate(const LabelFrame& labels, Handle begin,
+                                Handle end, double* penalties) {
+  DCHECK_LE(end, Size());
+  const RuleMonitor* rule = nullptr;
+  CompiledAutomaton::APMask shared_known = 0;
+  CompiledAutomaton::APMask shared_values = 0;
+  double sum = 0.0;
+  for (Handle h = begin; h < end; ++h) {
+    Entry& entry = entries_[h];
+    entry.rule->CheckBound(entry.label_slots_begin != kUnbound);
+    if (entry.rule != rule) {
+      rule = entry.rule;
+      shared_known = rule->alive_mask_;
+      shared_values = rule->alive_mask_;
+      rule->ResolveLabels(labels, false, nullptr, &shared_known,
+                          &shared_values);
+    }
+    double penalty = 0.0;
+    if (!rule->IsDecided(entry.current_state)) {
+      CompiledAutomaton::APMask known = shared_known;
+      CompiledAutomaton::APMask values = shared_values;
+      if (rule->rule_is_agent_specific_) {
+        rule->ResolveLabels(labels, true,
+                            &label_slots_[entry.label_slots_begin], &known,
+                            &values);
+      }
+      penalty = rule->TransitInstance(known, values, true, entry.agent_ids,
+                                      &entry.current_state, &entry.violations);
+    }
+    if (penalties) {
+      penalties[h - begin] = penalty;
+    }
+    sum += penalty;
+  }
+  return sum;
+}
+
+double RuleStateArena::FinalTransit(Handle handle) const {
+  const Entry& entry = entries_[handle];
+  return entry.rule->FinalPenalty(entry.current_state);
+}
+
+const RuleMonitor& RuleStateArena::GetRule(Handle handle) const {
+  return *entries_[handle].rule;
+}
+
+uint32_t RuleStateArena::GetCurrentState(Handle handle) const {
+  return entries_[handle].current_state;
+}
+
+size_t RuleStateArena::GetViolationCount(Handle handle) const {
+  return entries_[handle].violations;
+}
+
+const int* RuleStateArena::GetAgentIds(Handle handle) const {
+  return entries_[handle].agent_ids;
+}
+
+}  // namespace ltl
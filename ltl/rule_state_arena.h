@@ -0,0 +1,82 @@
+// Copyright (c) 2020 Klemens Esterle, Luis Gressenbuch
+//
+// This work is licensed under the terms of the MIT license.
+// For a copy, see <https://opensource.org/licenses/MIT>.
+
+#ifndef LTL_RULE_STATE_ARENA_H_
+#define LTL_RULE_STATE_ARENA_H_
+
+#include <cstdint>
+#include <vector>
+
+#include "bark/world/evaluation/ltl/label/label.h"
+#include "ltl/label_frame.h"
+
+namespace ltl {
+using bark::world::evaluation::EvaluationMap;
+
+class RuleMonitor;
+
+/// Rule states of one evaluation episode, possibly of different rules,
+/// addressed by integer handles.
+///
+/// Agent tuples are stored inline for rules with up to kMaxArity
+/// placeholders. Handles stay valid until Reset, which releases all states at
+/// once but keeps the memory, so stepping and later episodes of similar size
+/// do not allocate. The arena does not own the rules, they have to outlive it.
+class RuleStateArena {
+ public:
+  typedef uint32_t Handle;
+  static constexpr size_t kMaxArity = 4;
+
+  explicit RuleStateArena(size_t capacity = 0);
+
+  /// Add a state of rule in the initial automaton state.
+  /// \param agent_ids Agent tuple with one id per placeholder of rule,
+  /// nullptr only for rules without placeholders
+  Handle Add(const RuleMonitor& rule, const int* agent_ids = nullptr);
+  /// Add the states RuleMonitor::MakeRuleState would create. Their handles
+  /// are consecutive and end at Size().
+  /// \return Number of states added
+  size_t AddAgents(const RuleMonitor& rule, const std::vector<int>& agent_ids);
+  /// Release all states.
+  void Reset();
+
+  double Evaluate(const EvaluationMap& labels, Handle handle);
+  /// Evaluate on a frame of the registry bound to the rule of handle.
+  double Evaluate(const LabelFrame& labels, Handle handle);
+  /// Advance the states [begin, end). Labels that are not agent specific are
+  /// resolved once per run of states of the same rule.
+  /// \param penalties Optional output, end - begin penalties
+  double Evaluate(const EvaluationMap& labels, Handle begin, Handle end,
+                  double* penalties);
+  double Evaluate(const LabelFrame& labels, Handle begin, Handle end,
+                  double* penalties);
+  double FinalTransit(Handle handle) const;
+
+  size_t Size() const { return entries_.size(); }
+  const RuleMonitor& GetRule(Handle handle) const;
+  uint32_t GetCurrentState(Handle handle) const;
+  size_t GetViolationCount(Handle handle) const;
+  /// Agent tuple of the state, one id per placeholder of its rule.
+  const int* GetAgentIds(Handle handle) const;
+
+ private:
+  static constexpr uint32_t kUnbound = ~uint32_t(0);
+
+  struct Entry {
+    const RuleMonitor* rule;
+    uint32_t current_state;
+    // Offset into label_slots_, kUnbound if the rule had no bound labels
+    uint32_t label_slots_begin;
+    size_t violations;
+    int agent_ids[kMaxArity];
+  };
+
+  std::vector<Entry> entries_;
+  std::vector<int> label_slots_;
+};
+
+}  // namespace ltl
+
+#endif  // LTL_RULE_STATE_ARENA_H_
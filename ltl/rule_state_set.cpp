@@ -0,0 +1,617 @@
+// Copyright (c) 2020 Klemens Esterle, Luis Gressenbuch
+//
+// This work is licensed under the terms of the MIT license.
+// For a copy, see <https://opensource.org/licenses/MIT>.
+
+#include "ltl/rule_state_set.h"
+
+#include <algorithm>
+#include <functional>
+#include <iterator>
+#include <utility>
+
+#include "glog/logging.h"
+#include "ltl/rule_monitor.h"
+
+namespace ltl {
+
+RuleStateSet::RuleStateSet(std::shared_ptr<const RuleMonitor> monitor)
+    : monitor_(std::move(monitor)),
+      arity_(monitor_->GetNumPlaceholders()),
+      num_label_slots_(0) {
+  if (monitor_->label_registry_ && monitor_->IsAgentSpecific()) {
+    num_label_slots_ = monitor_->label_bindings_.size();
+  }
+}
+
+void RuleStateSet::AgentIndex::Add(const int* agent_ids, size_t arity,
+                                   size_t idx) {
+  for (size_t p = 0; p < arity; ++p) {
+    std::vector<size_t>& list = instances[agent_ids[p]];
+    list_pos.push_back(list.size());
+    list.push_back(idx);
+  }
+}
+
+void RuleStateSet::AgentIndex::Remove(const std::vector<int>& tuples,
+                                      size_t arity, size_t idx, size_t last) {
+  // Unlink the instance from the lists of its agents
+  for (size_t p = 0; p < arity; ++p) {
+    const int id = tuples[idx * arity + p];
+    std::vector<size_t>& list = instances.at(id);
+    const size_t pos = list_pos[idx * arity + p];
+    const size_t moved = list.back();
+    list[pos] = moved;
+    list.pop_back();
+    if (moved != idx) {
+      for (size_t q = 0; q < arity; ++q) {
+        if (tuples[moved * arity + q] == id) {
+          list_pos[moved * arity + q] = pos;
+        }
+      }
+    }
+  }
+  if (idx != last) {
+    std::copy_n(list_pos.begin() + last * arity, arity,
+                list_pos.begin() + idx * arity);
+    // Relink the moved instance
+    for (size_t p = 0; p < arity; ++p) {
+      instances.at(tuples[last * arity + p])[list_pos[idx * arity + p]] = idx;
+    }
+  }
+  list_pos.resize(last * arity);
+}
+
+size_t RuleStateSet::AgentIndex::Find(const std::vector<int>& tuples,
+                                      size_t arity,
+                                      const int* agent_ids) const {
+  auto it = instances.find(agent_ids[0]);
+  if (it == instances.end()) {
+    return kNotFound;
+  }
+  for (size_t idx : it->second) {
+    if (std::equal(agent_ids, agent_ids + arity,
+                   tuples.begin() + idx * arity)) {
+      return idx;
+    }
+  }
+  return kNotFound;
+}
+
+void RuleStateSet::AddAgents(const std::vector<int>& agent_ids) {
+  std::vector<int> added;
+  for (int id : agent_ids) {
+    if (!std::binary_search(agents_.begin(), agents_.end(), id)) {
+      added.push_back(id);
+    }
+  }
+  std::sort(added.begin(), added.end());
+  added.erase(std::unique(added.begin(), added.end()), added.end());
+  if (arity_ > 0 && !relevance_filter_) {
+    monitor_->ForEachNewInstance(
+        agents_, added, [this](const std::vector<int>& perm) { Add(perm); });
+  }
+  std::vector<int> agents;
+  std::merge(agents_.begin(), agents_.end(), added.begin(), added.end(),
+             std::back_inserter(agents));
+  agents_.swap(agents);
+  layout_.reset();
+  if (arity_ > 0 && relevance_filter_ && !added.empty()) {
+    InstantiateRelevant();
+  }
+}
+
+void RuleStateSet::RemoveAgents(const std::vector<int>& agent_ids,
+                                const RetireCallback& on_retire) {
+  for (int id : agent_ids) {
+    auto it = active_index_.instances.find(id);
+    if (it != active_index_.instances.end()) {
+      // Remove shrinks the list of this agent by one
+      while (!it->second.empty()) {
+        const size_t idx = it->second.back();
+        if (on_retire) {
+          on_retire(GetRuleState(idx), GetFinalPenalty(idx));
+        }
+        Remove(idx);
+      }
+      active_index_.instances.erase(it);
+    }
+    auto parked = parked_index_.instances.find(id);
+    if (parked != parked_index_.instances.end()) {
+      while (!parked->second.empty()) {
+        const size_t j = parked->second.back();
+        if (on_retire) {
+          on_retire(GetParkedRuleState(j),
+                    monitor_->FinalPenalty(parked_states_[j]));
+        }
+        Unpark(j);
+      }
+      parked_index_.instances.erase(parked);
+    }
+    auto agent_it = std::lower_bound(agents_.begin(), agents_.end(), id);
+    if (agent_it != agents_.end() && *agent_it == id) {
+      agents_.erase(agent_it);
+    }
+  }
+  layout_.reset();
+}
+
+const std::vector<int>& RuleStateSet::GetAgents() const { return agents_; }
+
+void RuleStateSet::SetRelevanceFilter(const RelevanceFilter& filter,
+                                      const NeighborQuery& neighbors) {
+  relevance_filter_ = filter;
+  neighbor_query_ = neighbors;
+}
+
+void RuleStateSet::UpdateRelevance() {
+  if (!relevance_filter_ || arity_ == 0) {
+    return;
+  }
+  // Iterate backwards, Park moves the last instance which is already checked
+  for (size_t i = Size(); i-- > 0;) {
+    if (!relevance_filter_(GetAgentIds(i), arity_)) {
+      Park(i);
+    }
+  }
+  const size_t num_active = Size();
+  InstantiateRelevant();
+  VLOG(3) << "Relevant instances: " << num_active << " kept, "
+          << Size() - num_active << " added, " << GetNumParked()
+          << " parked";
+}
+
+void RuleStateSet::InstantiateRelevant() {
+  // Neighbors within the set, sorted, and agents interacting with any agent
+  std::unordered_map<int, std::vector<int>> neighbors;
+  std::vector<int> wildcards;
+  if (neighbor_query_) {
+    std::vector<int> result;
+    for (int id : agents_) {
+      result.clear();
+      if (!neighbor_query_(id, &result)) {
+        wildcards.push_back(id);
+        continue;
+      }
+      std::vector<int>& known = neighbors[id];
+      for (int neighbor : result) {
+        if (std::binary_search(agents_.begin(), agents_.end(), neighbor)) {
+          known.push_back(neighbor);
+        }
+      }
+      std::sort(known.begin(), known.end());
+      known.erase(std::unique(known.begin(), known.end()), known.end());
+    }
+  }
+
+  const bool canonical_only = monitor_->GetMultiplicity() > 1;
+  std::vector<int> tuple(arity_);
+  std::vector<int> candidates;
+  std::vector<bool> used;
+  std::function<void(size_t)> place = [&](size_t pos) {
+    if (pos == arity_) {
+      if ((canonical_only && !monitor_->IsCanonical(tuple.data())) ||
+          active_index_.Find(agent_ids_, arity_, tuple.data()) != kNotFound ||
+          !relevance_filter_(tuple.data(), arity_)) {
+        return;
+      }
+      const size_t parked =
+          parked_index_.Find(parked_agent_ids_, arity_, tuple.data());
+      const size_t idx = Add(tuple);
+      if (parked != kNotFound) {
+        current_states_[idx] = parked_states_[parked];
+        violations_[idx] = parked_violations_[parked];
+        Unpark(parked);
+      }
+      return;
+    }
+    for (size_t i = 0; i < candidates.size(); ++i) {
+      if (!used[i]) {
+        used[i] = true;
+        tuple[pos] = candidates[i];
+        place(pos + 1);
+        used[i] = false;
+      }
+    }
+  };
+  for (int first : agents_) {
+    candidates.clear();
+    auto known = neighbors.find(first);
+    if (known == neighbors.end()) {
+      // Unrestricted, either without a neighbor query or a wildcard
+      candidates = agents_;
+    } else {
+      std::set_union(known->second.begin(), known->second.end(),
+                     wildcards.begin(), wildcards.end(),
+                     std::back_inserter(candidates));
+    }
+    candidates.erase(std::remove(candidates.begin(), candidates.end(), first),
+                     candidates.end());
+    used.assign(candidates.size(), false);
+    tuple[0] = first;
+    place(1);
+  }
+}
+
+size_t RuleStateSet::GetNumParked() const { return parked_states_.size(); }
+
+void RuleStateSet::Park(size_t idx) {
+  if (current_states_[idx] != monitor_->compiled_->GetInitState() ||
+      violations_[idx] != 0) {
+    parked_index_.Add(GetAgentIds(idx), arity_, GetNumParked());
+    parked_agent_ids_.insert(parked_agent_ids_.end(), GetAgentIds(idx),
+                             GetAgentIds(idx) + arity_);
+    parked_states_.push_back(current_states_[idx]);
+    parked_violations_.push_back(violations_[idx]);
+  }
+  Remove(idx);
+}
+
+void RuleStateSet::Unpark(size_t parked_idx) {
+  const size_t last = GetNumParked() - 1;
+  parked_index_.Remove(parked_agent_ids_, arity_, parked_idx, last);
+  if (parked_idx != last) {
+    std::copy_n(parked_agent_ids_.begin() + last * arity_, arity_,
+                parked_agent_ids_.begin() + parked_idx * arity_);
+    parked_states_[parked_idx] = parked_states_[last];
+    parked_violations_[parked_idx] = parked_violations_[last];
+  }
+  parked_agent_ids_.resize(last * arity_);
+  parked_states_.pop_back();
+  parked_violations_.pop_back();
+  layout_.reset();
+}
+
+RuleState RuleStateSet::GetParkedRuleState(size_t parked_idx) const {
+  const int* agent_ids = &parked_agent_ids_[parked_idx * arity_];
+  return RuleState(parked_states_[parked_idx], parked_violations_[parked_idx],
+                   monitor_, std::vector<int>(agent_ids, agent_ids + arity_));
+}
+
+size_t RuleStateSet::Add(const std::vector<int>& agent_ids) {
+  CHECK_EQ(agent_ids.size(), arity_) << "Agent tuple has wrong arity!";
+  // The agent index holds one entry per agent of an instance
+  for (size_t i = 1; i < arity_; ++i) {
+    CHECK(std::find(agent_ids.begin(), agent_ids.begin() + i,
+                    agent_ids[i]) == agent_ids.begin() + i)
+        << "Agent tuple has to contain distinct agents!";
+  }
+  monitor_->RecordInstances(1);
+  const size_t idx = current_states_.size();
+  current_states_.push_back(monitor_->compiled_->GetInitState());
+  violations_.push_back(0);
+  stuttering_.push_back(false);
+  agent_ids_.insert(agent_ids_.end(), agent_ids.begin(), agent_ids.end());
+  active_index_.Add(agent_ids.data(), arity_, idx);
+  if (num_label_slots_ > 0) {
+    label_slots_.resize(label_slots_.size() + num_label_slots_);
+    monitor_->BindAgentLabels(agent_ids.data(),
+                              &label_slots_[idx * num_label_slots_]);
+  }
+  layout_.reset();
+  return idx;
+}
+
+void RuleStateSet::Remove(size_t idx) {
+  const size_t last = Size() - 1;
+  active_index_.Remove(agent_ids_, arity_, idx, last);
+  if (idx != last) {
+    current_states_[idx] = current_states_[last];
+    violations_[idx] = violations_[last];
+    stuttering_[idx] = stuttering_[last];
+    std::copy_n(agent_ids_.begin() + last * arity_, arity_,
+                agent_ids_.begin() + idx * arity_);
+    std::copy_n(label_slots_.begin() + last * num_label_slots_,
+                num_label_slots_, label_slots_.begin() + idx * num_label_slots_);
+  }
+  current_states_.pop_back();
+  violations_.pop_back();
+  stuttering_.pop_back();
+  agent_ids_.resize(last * arity_);
+  label_slots_.resize(last * num_label_slots_);
+  layout_.reset();
+}
+
+void RuleStateSet::Clear() {
+  current_states_.clear();
+  violations_.clear();
+  stuttering_.clear();
+  agent_ids_.clear();
+  label_slots_.clear();
+  active_index_ = AgentIndex();
+  agents_.clear();
+  parked_agent_ids_.clear();
+  parked_index_ = AgentIndex();
+  parked_states_.clear();
+  parked_violations_.clear();
+  layout_.reset();
+}
+
+double RuleStateSet::Evaluate(const EvaluationMap& labels,
+                              std::vector<double>* penalties) {
+  if (penalties) {
+    penalties->resize(Size());
+  }
+  return Evaluate(labels, 0, Size(), penalties ? penalties->data() : nullptr);
+}
+
+double RuleStateSet::Evaluate(const LabelFrame& labels,
+                              std::vector<double>* penalties) {
+  if (penalties) {
+    penalties->resize(Size());
+  }
+  return Evaluate(labels, 0, Size(), penalties ? penalties->data() : nullptr);
+}
+
+double RuleStateSet::Evaluate(const EvaluationMap& labels, size_t begin,
+                              size_t end, double* penalties) {
+  DCHECK_LE(end, Size());
+  const RuleMonitor& monitor = *monitor_;
+  RuleMetricsRecorder::ScopedTimer timer(monitor.metrics_);
+  const bool alive = RuleMonitor::IsAlive(labels);
+  CompiledAutomaton::APMask shared_known = 0;
+  CompiledAutomaton::APMask shared_values = 0;
+  monitor.ResolveLabels(labels, alive, false, nullptr, &shared_known,
+                        &shared_values);
+  double sum = 0.0;
+  for (size_t i = begin; i < end; ++i) {
+    if (alive && monitor.IsDecided(current_states_[i])) {
+      if (penalties) {
+        penalties[i - begin] = 0.0;
+      }
+      continue;
+    }
+    CompiledAutomaton::APMask known = shared_known;
+    CompiledAutomaton::APMask values = shared_values;
+    if (arity_ > 0) {
+      monitor.ResolveLabels(labels, alive, true, &agent_ids_[i * arity_],
+                            &known, &values);
+    }
+    const double penalty = Step(i, known, values, alive);
+    if (penalties) {
+      penalties[i - begin] = penalty;
+    }
+    sum += penalty;
+  }
+  return sum;
+}
+
+double RuleStateSet::Evaluate(const LabelFrame& labels, size_t begin,
+                              size_t end, double* penalties) {
+  DCHECK_LE(end, Size());
+  const RuleMonitor& monitor = *monitor_;
+  RuleMetricsRecorder::ScopedTimer timer(monitor.metrics_);
+  monitor.CheckBound(num_label_slots_ > 0);
+  CompiledAutomaton::APMask shared_known = monitor.alive_mask_;
+  CompiledAutomaton::APMask shared_values = monitor.alive_mask_;
+  monitor.ResolveLabels(labels, false, nullptr, &shared_known, &shared_values);
+  double sum = 0.0;
+  for (size_t i = begin; i < end; ++i) {
+    if (monitor.IsDecided(current_states_[i])) {
+      if (penalties) {
+        penalties[i - begin] = 0.0;
+      }
+      continue;
+    }
+    CompiledAutomaton::APMask known = shared_known;
+    CompiledAutomaton::APMask values = shared_values;
+    if (num_label_slots_ > 0) {
+      monitor.ResolveLabels(labels, true, &label_slots_[i * num_label_slots_],
+                            &known, &values);
+    }
+    const double penalty = Step(i, known, values, true);
+    if (penalties) {
+      penalties[i - begin] = penalty;
+    }
+    sum += penalty;
+  }
+  return sum;
+}
+
+double RuleStateSet::EvaluateDelta(const LabelFrame& labels,
+                                   std::vector<double>* penalties) {
+  const RuleMonitor& monitor = *monitor_;
+  RuleMetricsRecorder::ScopedTimer timer(monitor.metrics_);
+  const CompiledAutomaton& compiled = *monitor.compiled_;
+  monitor.CheckBound(num_label_slots_ > 0);
+  CompiledAutomaton::APMask shared_known = monitor.alive_mask_;
+  CompiledAutomaton::APMask shared_values = monitor.alive_mask_;
+  monitor.ResolveLabels(labels, false, nullptr, &shared_known, &shared_values);
+  const CompiledAutomaton::APMask shared_changed =
+      monitor.ChangedAPs(labels, false, nullptr);
+  if (penalties) {
+    penalties->assign(Size(), 0.0);
+  }
+  double sum = 0.0;
+  size_t num_stepped = 0;
+  for (size_t i = 0; i < Size(); ++i) {
+    const uint32_t state = current_states_[i];
+    if (monitor.IsDecided(state)) {
+      continue;
+    }
+    const int* label_slots =
+        num_label_slots_ > 0 ? &label_slots_[i * num_label_slots_] : nullptr;
+    if (stuttering_[i]) {
+      CompiledAutomaton::APMask changed = shared_changed;
+      if (label_slots) {
+        changed |= monitor.ChangedAPs(labels, true, label_slots);
+      }
+      if ((changed & compiled.GetSupport(state)) == 0) {
+        // The same self-loop is taken again
+        continue;
+      }
+    }
+    CompiledAutomaton::APMask known = shared_known;
+    CompiledAutomaton::APMask values = shared_values;
+    if (label_slots) {
+      monitor.ResolveLabels(labels, true, label_slots, &known, &values);
+    }
+    const double penalty = Step(i, known, values, true);
+    if (penalties) {
+      (*penalties)[i] = penalty;
+    }
+    sum += penalty;
+    ++num_stepped;
+  }
+  VLOG(4) << "Stepped " << num_stepped << " of " << Size() << " instances";
+  return sum;
+}
+
+void RuleStateSet::EvaluateTrace(const LabelTrace& trace,
+                                 TraceResult* result) {
+  const RuleMonitor& monitor = *monitor_;
+  monitor.CheckBound(num_label_slots_ > 0);
+  // Instances are advanced in groups of kLanes. The labels of a group are
+  // resolved before any of its automata is stepped, which keeps the frame
+  // lookups and the table walks in separate, independent loops.
+  constexpr size_t kLanes = 8;
+  CompiledAutomaton::APMask known[kLanes];
+  CompiledAutomaton::APMask values[kLanes];
+  bool decided[kLanes];
+  result->step_penalties.assign(trace.GetNumSteps(), 0.0);
+  result->violations.clear();
+  LabelFrame frame(trace.GetNumSlots());
+  bool all_decided = false;
+  // Once all instances are decided, the remaining steps have no effect
+  for (size_t t = 0; t < trace.GetNumSteps() && !all_decided; ++t) {
+    trace.GetFrame(t, &frame);
+    CompiledAutomaton::APMask shared_known = monitor.alive_mask_;
+    CompiledAutomaton::APMask shared_values = monitor.alive_mask_;
+    monitor.ResolveLabels(frame, false, nullptr, &shared_known,
+                          &shared_values);
+    double sum = 0.0;
+    all_decided = true;
+    for (size_t begin = 0; begin < Size(); begin += kLanes) {
+      const size_t num_lanes = std::min(kLanes, Size() - begin);
+      for (size_t l = 0; l < num_lanes; ++l) {
+        decided[l] = monitor.IsDecided(current_states_[begin + l]);
+        known[l] = shared_known;
+        values[l] = shared_values;
+        if (num_label_slots_ > 0 && !decided[l]) {
+          monitor.ResolveLabels(
+              frame, true, &label_slots_[(begin + l) * num_label_slots_],
+              &known[l], &values[l]);
+        }
+      }
+      for (size_t l = 0; l < num_lanes; ++l) {
+        if (decided[l]) {
+          continue;
+        }
+        const size_t i = begin + l;
+        const size_t violations_before = violations_[i];
+        sum += Step(i, known[l], values[l], true, t);
+        if (violations_[i] != violations_before) {
+          result->violations.push_back({t, i});
+        }
+        all_decided &= monitor.IsDecided(current_states_[i]);
+      }
+    }
+    result->step_penalties[t] = sum;
+  }
+}
+
+double RuleStateSet::Step(size_t i, CompiledAutomaton::APMask known,
+                          CompiledAutomaton::APMask values, bool alive,
+                          int64_t step) {
+  const uint32_t state = current_states_[i];
+  const size_t violations = violations_[i];
+  const double penalty = monitor_->TransitInstance(
+      known, values, alive, arity_ > 0 ? &agent_ids_[i * arity_] : nullptr,
+      &current_states_[i], &violations_[i], step);
+  stuttering_[i] =
+      current_states_[i] == state && violations_[i] == violations && alive;
+  return penalty;
+}
+
+double RuleStateSet::FinalTransit(std::vector<double>* penalties) const {
+  const size_t num_instances = Size() + GetNumParked();
+  if (penalties) {
+    penalties->resize(num_instances);
+  }
+  double sum = 0.0;
+  for (size_t i = 0; i < num_instances; ++i) {
+    const double penalty = GetFinalPenalty(i);
+    if (penalties) {
+      (*penalties)[i] = penalty;
+    }
+    sum += penalty;
+  }
+  return sum;
+}
+
+double RuleStateSet::GetFinalPenalty(size_t idx) const {
+  if (idx >= Size()) {
+    return monitor_->FinalPenalty(parked_states_.at(idx - Size()));
+  }
+  return monitor_->FinalPenalty(current_states_[idx]);
+}
+
+void RuleStateSet::SaveSnapshot(Snapshot* snapshot) {
+  snapshot->current_states = current_states_;
+  snapshot->violations = violations_;
+  snapshot->stuttering = stuttering_;
+  snapshot->parked_states = parked_states_;
+  snapshot->parked_violations = parked_violations_;
+  if (!layout_) {
+    layout_ = std::make_shared<const Layout>(
+        Layout{agent_ids_, label_slots_, active_index_, agents_,
+               parked_agent_ids_, parked_index_});
+  }
+  snapshot->layout = layout_;
+}
+
+RuleStateSet::Snapshot RuleStateSet::SaveSnapshot() {
+  Snapshot snapshot;
+  SaveSnapshot(&snapshot);
+  return snapshot;
+}
+
+void RuleStateSet::RestoreSnapshot(const Snapshot& snapshot) {
+  CHECK(snapshot.layout) << "Empty snapshot!";
+  CHECK_EQ(snapshot.layout->agent_ids.size(),
+           snapshot.current_states.size() * arity_)
+      << "Snapshot of a different rule!";
+  current_states_ = snapshot.current_states;
+  violations_ = snapshot.violations;
+  stuttering_ = snapshot.stuttering;
+  parked_states_ = snapshot.parked_states;
+  parked_violations_ = snapshot.parked_violations;
+  if (layout_ != snapshot.layout) {
+    const Layout& layout = *snapshot.layout;
+    agent_ids_ = layout.agent_ids;
+    label_slots_ = layout.label_slots;
+    active_index_ = layout.active_index;
+    agents_ = layout.agents;
+    parked_agent_ids_ = layout.parked_agent_ids;
+    parked_index_ = layout.parked_index;
+    layout_ = snapshot.layout;
+  }
+}
+
+size_t RuleStateSet::Size() const { return current_states_.size(); }
+size_t RuleStateSet::GetArity() const { return arity_; }
+uint32_t RuleStateSet::GetCurrentState(size_t idx) const {
+  return current_states_[idx];
+}
+size_t RuleStateSet::GetViolationCount(size_t idx) const {
+  return violations_[idx];
+}
+void RuleStateSet::ResetViolations() {
+  std::fill(violations_.begin(), violations_.end(), 0);
+}
+const int* RuleStateSet::GetAgentIds(size_t idx) const {
+  return agent_ids_.data() + idx * arity_;
+}
+RuleState RuleStateSet::GetRuleState(size_t idx) const {
+  RuleState state(current_states_[idx], violations_[idx], monitor_,
+                  std::vector<int>(GetAgentIds(idx), GetAgentIds(idx) + arity_));
+  state.label_slots_.assign(
+      label_slots_.begin() + idx * num_label_slots_,
+      label_slots_.begin() + (idx + 1) * num_label_slots_);
+  return state;
+}
+const std::shared_ptr<const RuleMonitor>& RuleStateSet::GetMonitor() const {
+  return monitor_;
+}
+
+}  // namespace ltl
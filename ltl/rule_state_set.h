@@ -0,0 +1,230 @@
+// Copyright (c) 2020 Klemens Esterle, Luis Gressenbuch
+//
+// This work is licensed under the terms of the MIT license.
+// For a copy, see <https://opensource.org/licenses/MIT>.
+
+#ifndef LTL_RULE_STATE_SET_H_
+#define LTL_RULE_STATE_SET_H_
+
+#include <cstdint>
+#include <functional>
+#include <memory>
+#include <unordered_map>
+#include <vector>
+
+#include "bark/world/evaluation/ltl/label/label.h"
+#include "ltl/common.h"
+#include "ltl/compiled_automaton.h"
+#include "ltl/label_frame.h"
+#include "ltl/rule_state.h"
+
+namespace ltl {
+using bark::world::evaluation::EvaluationMap;
+
+class RuleMonitor;
+class RuleState;
+
+/// All rule states of one RuleMonitor in structure-of-arrays layout.
+///
+/// Automaton states, violation counters and agent tuples are kept in separate
+/// contiguous arrays. Agent tuples have the fixed arity of the rule, i.e. its
+/// number of placeholders. Use RuleState as a view on single instances.
+class RuleStateSet {
+ public:
+  /// Called for each instance retired by RemoveAgents, before it is removed.
+  typedef std::function<void(const RuleState& state, double final_penalty)>
+      RetireCallback;
+  /// Decides if an agent tuple may currently interact, see UpdateRelevance.
+  typedef std::function<bool(const int* agent_ids, size_t arity)>
+      RelevanceFilter;
+  /// Adds the agents which may share a relevant tuple with agent_id to
+  /// neighbors, see SetRelevanceFilter.
+  /// \return False if agent_id may interact with any agent
+  typedef std::function<bool(int agent_id, std::vector<int>* neighbors)>
+      NeighborQuery;
+
+  struct TraceViolation {
+    size_t step;
+    size_t instance;
+  };
+  struct TraceResult {
+    // Sum of the penalties of all instances per timestep
+    std::vector<double> step_penalties;
+    // Violations ordered by timestep and instance, each one incurs the
+    // weight of the rule times RuleMonitor::GetMultiplicity as penalty
+    std::vector<TraceViolation> violations;
+  };
+
+  struct Layout;
+  /// Rule states of a set at one point in time, see SaveSnapshot.
+  struct Snapshot {
+    std::vector<uint32_t> current_states;
+    std::vector<size_t> violations;
+    std::vector<uint8_t> stuttering;
+    std::vector<uint32_t> parked_states;
+    std::vector<size_t> parked_violations;
+    // Agent tuples and label bindings, shared by all snapshots taken while
+    // the instances of the set were not added or removed
+    std::shared_ptr<const Layout> layout;
+  };
+
+  explicit RuleStateSet(std::shared_ptr<const RuleMonitor> monitor);
+
+  /// Add agents to the scene. Only instances for agent tuples involving at
+  /// least one of the new agents are created.
+  void AddAgents(const std::vector<int>& agent_ids);
+  /// Remove agents from the scene and retire all instances involving them.
+  void RemoveAgents(const std::vector<int>& agent_ids,
+                    const RetireCallback& on_retire = nullptr);
+  /// Agents added by AddAgents and not yet removed, sorted.
+  const std::vector<int>& GetAgents() const;
+
+  /// Only instances of relevant agent tuples are created, tuples which never
+  /// were relevant incur no penalties. Instances whose tuple is no longer
+  /// relevant are parked: they keep their automaton state and violation
+  /// count, are not evaluated, but count in FinalTransit. Parked instances
+  /// equal to a fresh instance are dropped.
+  ///
+  /// Relevant tuples are searched by AddAgents and UpdateRelevance. Without
+  /// neighbors, every tuple of the agents is checked. With neighbors, only
+  /// tuples whose agents are neighbors of their first agent are checked, so
+  /// the cost scales with the number of neighbors. The neighbors of an agent
+  /// have to contain all agents it shares a relevant tuple with, except for
+  /// agents whose query returns false, which are neighbors of every agent.
+  void SetRelevanceFilter(const RelevanceFilter& filter,
+                          const NeighborQuery& neighbors = nullptr);
+  /// Park instances that became irrelevant, revive parked instances and
+  /// create instances for tuples that became relevant. Call once per step
+  /// before Evaluate.
+  void UpdateRelevance();
+  size_t GetNumParked() const;
+
+  /// Add an instance in the initial automaton state. The agents of the tuple
+  /// have to be distinct.
+  /// \return Index of the new instance
+  size_t Add(const std::vector<int>& agent_ids);
+  /// Remove the instance at idx. The last instance is moved to idx.
+  void Remove(size_t idx);
+  void Clear();
+
+  /// Advance all instances on the same labels.
+  /// \param penalties Optional output, one penalty per instance
+  /// \return Sum of all penalties
+  double Evaluate(const EvaluationMap& labels,
+                  std::vector<double>* penalties = nullptr);
+  double Evaluate(const LabelFrame& labels,
+                  std::vector<double>* penalties = nullptr);
+  /// Advance the instances in [begin, end). Disjoint ranges may be advanced
+  /// concurrently.
+  /// \param penalties Optional output, end - begin penalties
+  double Evaluate(const EvaluationMap& labels, size_t begin, size_t end,
+                  double* penalties);
+  double Evaluate(const LabelFrame& labels, size_t begin, size_t end,
+                  double* penalties);
+  /// Same result as Evaluate, but only instances whose inputs changed are
+  /// stepped. An instance is skipped if its last step looped in its state
+  /// and no label its state depends on is marked as changed in labels. The
+  /// changes have to cover everything since the previous evaluation of this
+  /// set. Missing labels are not detected for skipped instances.
+  double EvaluateDelta(const LabelFrame& labels,
+                       std::vector<double>* penalties = nullptr);
+  /// Advance all instances over a whole trace, equivalent to calling
+  /// Evaluate on each of its frames in order. Logged violations get the
+  /// step within the trace.
+  void EvaluateTrace(const LabelTrace& trace, TraceResult* result);
+  /// Penalties at the end of the episode, see RuleMonitor::FinalTransit.
+  /// \param penalties Optional output, one penalty per instance followed by
+  /// one per parked instance
+  double FinalTransit(std::vector<double>* penalties = nullptr) const;
+  /// Final penalty of instance idx, or of parked instance idx - Size().
+  double GetFinalPenalty(size_t idx) const;
+
+  /// Save automaton states and violation counters into snapshot, reusing
+  /// its buffers. The agent tuples are copied only if instances have been
+  /// added or removed since the last snapshot, otherwise they are shared.
+  void SaveSnapshot(Snapshot* snapshot);
+  Snapshot SaveSnapshot();
+  /// Return to the state of snapshot, which has to be taken from a set of
+  /// the same monitor. Agent tuples are copied only if they differ.
+  void RestoreSnapshot(const Snapshot& snapshot);
+
+  size_t Size() const;
+  size_t GetArity() const;
+  uint32_t GetCurrentState(size_t idx) const;
+  size_t GetViolationCount(size_t idx) const;
+  void ResetViolations();
+  /// Agent tuple of instance idx, GetArity() elements.
+  const int* GetAgentIds(size_t idx) const;
+  RuleState GetRuleState(size_t idx) const;
+  const std::shared_ptr<const RuleMonitor>& GetMonitor() const;
+
+ private:
+  static constexpr size_t kNotFound = ~size_t(0);
+
+  // Instances involving each agent, for tuples of a fixed arity stored in an
+  // array whose last element is moved into removed elements
+  struct AgentIndex {
+    /// Link instance idx with the tuple agent_ids.
+    void Add(const int* agent_ids, size_t arity, size_t idx);
+    /// Unlink instance idx and relink instance last, which is moved to idx.
+    /// tuples holds all tuples before the move.
+    void Remove(const std::vector<int>& tuples, size_t arity, size_t idx,
+                size_t last);
+    /// Index of the instance of the tuple agent_ids, kNotFound if none.
+    size_t Find(const std::vector<int>& tuples, size_t arity,
+                const int* agent_ids) const;
+
+    std::unordered_map<int, std::vector<size_t>> instances;
+    // Per tuple element, position of the instance in instances
+    std::vector<size_t> list_pos;
+  };
+
+  std::shared_ptr<const RuleMonitor> monitor_;
+  size_t arity_;
+  // Label slots per instance, zero if the monitor is not bound
+  size_t num_label_slots_;
+  std::vector<uint32_t> current_states_;
+  std::vector<size_t> violations_;
+  // Set if the last step looped in the current state
+  std::vector<uint8_t> stuttering_;
+  std::vector<int> agent_ids_;
+  std::vector<int> label_slots_;
+  AgentIndex active_index_;
+  std::vector<int> agents_;
+
+  /// Advance instance i and record if it stutters.
+  /// \param step Step of logged violations, -1 for the step of the log
+  double Step(size_t i, CompiledAutomaton::APMask known,
+              CompiledAutomaton::APMask values, bool alive,
+              int64_t step = -1);
+  /// Create or revive the instances of all relevant tuples.
+  void InstantiateRelevant();
+  /// Move instance idx to the parked instances, or drop it if it is in the
+  /// initial state without violations.
+  void Park(size_t idx);
+  void Unpark(size_t parked_idx);
+  RuleState GetParkedRuleState(size_t parked_idx) const;
+
+  RelevanceFilter relevance_filter_;
+  NeighborQuery neighbor_query_;
+  std::vector<int> parked_agent_ids_;
+  AgentIndex parked_index_;
+  std::vector<uint32_t> parked_states_;
+  std::vector<size_t> parked_violations_;
+  // Layout of the current instances, reset when instances are added or
+  // removed
+  std::shared_ptr<const Layout> layout_;
+};
+
+struct RuleStateSet::Layout {
+  std::vector<int> agent_ids;
+  std::vector<int> label_slots;
+  AgentIndex active_index;
+  std::vector<int> agents;
+  std::vector<int> parked_agent_ids;
+  AgentIndex parked_index;
+};
+
+}  // namespace ltl
+
+#endif  // LTL_RULE_STATE_SET_H_
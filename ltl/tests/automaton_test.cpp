@@ -3,10 +3,20 @@
 // This work is licensed under the terms of the MIT license.
 // For a copy, see <https://opensource.org/licenses/MIT>.
 
+#include <unistd.h>
+#include <cstdio>
+#include <cstring>
+#include <fstream>
+#include <stdexcept>
+#include <system_error>
+#include <thread>
+
 #include "gflags/gflags.h"
 #include "glog/logging.h"
 #include "gtest/gtest.h"
 #include "bark/world/evaluation/ltl/label/label.h"
+#include "ltl/rule_library.h"
+#include "ltl/rule_metrics.h"
 #include "ltl/rule_monitor.h"
 
 using namespace ltl;
@@ -46,9 +56,93 @@ TEST(AutomatonTest, parse_agent) {
         RuleMonitor::MakeRule("G agent#0", -1.0f, 0);
     aut =
         RuleMonitor::MakeRule("G agent_1_test#0", -1.0f, 0);
+    EXPECT_TRUE(aut->IsAgentSpecific());
+    EXPECT_EQ(1, aut->GetNumPlaceholders());
     aut = RuleMonitor::MakeRule("G agent_1_test#0 & agent2#1 & env", -1.0f,
                                 0);
-    // TODO: add checks
+    EXPECT_EQ(2, aut->GetNumPlaceholders());
+    // Placeholders with several digits
+    aut = RuleMonitor::MakeRule("G agent#12", -1.0f, 0);
+    EXPECT_EQ(13, aut->GetNumPlaceholders());
+    // Numbers are no APs
+    aut = RuleMonitor::MakeRule("G[0..2] a", -1.0f, 0);
+    EXPECT_FALSE(aut->IsAgentSpecific());
+    RuleState state = aut->MakeRuleState()[0];
+    EvaluationMap labels;
+    labels[Label("a")] = true;
+    EXPECT_EQ(0.0, aut->Evaluate(labels, state));
+}
+
+TEST(AutomatonTest, same_label_different_placeholders) {
+    RuleMonitorSPtr aut = RuleMonitor::MakeRule("G (a#0 & a#1)", -1.0f, 0);
+    std::vector<RuleState> states = aut->MakeRuleState({1, 2});
+    ASSERT_EQ(2, states.size());
+    EvaluationMap labels;
+    labels[Label("a", 1)] = true;
+    labels[Label("a", 2)] = true;
+    EXPECT_EQ(std::vector<double>({0.0, 0.0}),
+              aut->EvaluateBatch(labels, states));
+    labels[Label("a", 2)] = false;
+    EXPECT_EQ(std::vector<double>({-1.0, -1.0}),
+              aut->EvaluateBatch(labels, states));
+
+    // Serialized rules keep the distinct APs
+    aut = RuleMonitor::Deserialize(aut->Serialize());
+    states = aut->MakeRuleState({1, 2});
+    EXPECT_EQ(std::vector<double>({-1.0, -1.0}),
+              aut->EvaluateBatch(labels, states));
+}
+
+TEST(AutomatonTest, symmetry_reduction) {
+    RuleMonitorSPtr aut =
+        RuleMonitor::MakeRule("G !(collide#0 & collide#1)", -1.0f, 0);
+    ASSERT_EQ(2, aut->GetSymmetries().size());
+    EXPECT_EQ(std::vector<int>({1, 0}), aut->GetSymmetries()[1]);
+    // Disabled by default
+    EXPECT_EQ(1, aut->GetMultiplicity());
+    aut->SetSymmetryReduction(true);
+    EXPECT_EQ(2, aut->GetMultiplicity());
+    auto log = std::make_shared<ViolationLog>(16);
+    aut->SetViolationLog(log, 0);
+    std::vector<RuleState> states = aut->MakeRuleState({1, 2, 3});
+    // Only sorted tuples are instantiated
+    ASSERT_EQ(3, states.size());
+    EXPECT_EQ(std::vector<int>({1, 2}), states[0].GetAgentIds());
+    EXPECT_EQ(std::vector<std::vector<int>>({{1, 2}, {2, 1}}),
+              aut->GetEquivalentAgentIds(states[0].GetAgentIds()));
+    EXPECT_EQ(3, aut->MakeRuleStateSet({1, 2, 3}).Size());
+
+    EvaluationMap labels;
+    labels[Label("collide", 1)] = true;
+    labels[Label("collide", 2)] = true;
+    labels[Label("collide", 3)] = false;
+    // Same total penalty as both tuples (1, 2) and (2, 1)
+    EXPECT_EQ(std::vector<double>({-2.0, 0.0, 0.0}),
+              aut->EvaluateBatch(labels, states));
+    std::vector<ViolationRecord> records;
+    ASSERT_EQ(2, log->Drain(&records));
+    EXPECT_EQ(1, records[0].agent_ids[0]);
+    EXPECT_EQ(2, records[0].agent_ids[1]);
+    EXPECT_EQ(2, records[1].agent_ids[0]);
+    EXPECT_EQ(1, records[1].agent_ids[1]);
+
+    // Metrics are kept, rule states exist already
+    EXPECT_EQ(1, aut->GetMetrics().violations);
+    ASSERT_DEATH({ aut->SetSymmetryReduction(false); },
+                 "before creating rule states");
+    aut = RuleMonitor::MakeRule("G !(collide#0 & collide#1)", -1.0f, 0);
+    EXPECT_EQ(6, aut->MakeRuleState({1, 2, 3}).size());
+
+    // Deserialized rules detect the same symmetries
+    aut = RuleMonitor::Deserialize(aut->Serialize());
+    EXPECT_EQ(2, aut->GetSymmetries().size());
+
+    // Placeholders of different labels or in asymmetric positions
+    aut = RuleMonitor::MakeRule("G (a#0 & b#1)", -1.0f, 0);
+    EXPECT_EQ(1, aut->GetSymmetries().size());
+    aut = RuleMonitor::MakeRule("G (a#0 -> a#1)", -1.0f, 0);
+    EXPECT_EQ(1, aut->GetSymmetries().size());
+    EXPECT_EQ(6, aut->MakeRuleState({1, 2, 3}).size());
 }
 
 TEST(AutomatonTest, agent_specific_rule_state) {
@@ -80,6 +174,315 @@ TEST(AutomatonTest, agent_specific_rule_transition) {
     ASSERT_EQ(-1.0, res);
 }
 
+TEST(AutomatonTest, conjunction) {
+    RuleMonitorSPtr aut = RuleMonitor::MakeRule("G (a & b)", -1.0f, 0);
+    RuleState state = aut->MakeRuleState()[0];
+    EvaluationMap labels;
+    labels[Label("a")] = true;
+    labels[Label("b")] = true;
+    ASSERT_EQ(0.0, state.GetAutomaton()->Evaluate(labels, state));
+    labels[Label("b")] = false;
+    ASSERT_EQ(-1.0, state.GetAutomaton()->Evaluate(labels, state));
+    labels[Label("a")] = false;
+    labels[Label("b")] = true;
+    ASSERT_EQ(-1.0, state.GetAutomaton()->Evaluate(labels, state));
+    ASSERT_EQ(2, state.GetViolationCount());
+    ASSERT_EQ(0.0, state.GetAutomaton()->FinalTransit(state));
+}
+
+TEST(AutomatonTest, label_frame) {
+    auto registry = std::make_shared<LabelRegistry>();
+    RuleMonitorSPtr aut = RuleMonitor::MakeRule("G (a#0 & b)", -1.0f, 0);
+    aut->BindLabels(registry);
+    auto rule_states = aut->MakeRuleState({1, 2});
+    ASSERT_EQ(2, rule_states.size());
+    ASSERT_EQ(3, registry->GetNumSlots());
+    LabelFrame frame(*registry);
+    frame.Set(registry->GetSlot(Label("a", 1)), true);
+    frame.Set(registry->GetSlot(Label("a", 2)), false);
+    frame.Set(registry->GetSlot(Label("b")), true);
+    EXPECT_EQ(0.0, aut->Evaluate(frame, rule_states[0]));
+    EXPECT_EQ(-1.0, aut->Evaluate(frame, rule_states[1]));
+    frame.Unset(registry->GetSlot(Label("b")));
+    ASSERT_DEATH({ aut->Evaluate(frame, rule_states[0]); },
+                 "Missing label \"b\"!");
+
+    const uint8_t values[] = {1, 0, 1};
+    const uint8_t defined[] = {1, 1, 0};
+    frame.Assign(values, defined);
+    EXPECT_TRUE(frame.Get(0));
+    EXPECT_FALSE(frame.Get(1));
+    EXPECT_FALSE(frame.IsDefined(2));
+    EXPECT_FALSE(frame.Get(2));
+    frame.Assign(values);
+    EXPECT_TRUE(frame.IsDefined(2));
+    EXPECT_TRUE(frame.Get(2));
+}
+
+TEST(AutomatonTest, label_registry_agents) {
+    auto registry = std::make_shared<LabelRegistry>();
+    RuleMonitorSPtr aut = RuleMonitor::MakeRule("G (a#0 & b)", -1.0f, 0);
+    aut->BindLabels(registry);
+    auto rule_states = aut->MakeRuleState({1000000, 7});
+    ASSERT_EQ(2, registry->GetNumAgents());
+    const int a = registry->GetAgentLabelIndex("a");
+    ASSERT_EQ(0, a);
+    EXPECT_EQ(-1, registry->GetAgentLabelIndex("b"));
+    const int agent = registry->GetAgentIndex(1000000);
+    ASSERT_GE(agent, 0);
+    EXPECT_EQ(1000000, registry->GetAgentId(agent));
+    EXPECT_EQ(-1, registry->GetAgentIndex(3));
+    // Agent specific labels are found by table lookup and by label
+    EXPECT_EQ(registry->GetSlot(Label("a", 1000000)),
+              registry->GetSlot(a, agent));
+    EXPECT_EQ(registry->Register(Label("a", 7)),
+              registry->GetSlot(a, registry->GetAgentIndex(7)));
+
+    LabelFrame frame(*registry);
+    frame.Set(registry->GetSlot(a, registry->GetAgentIndex(7)), true);
+    frame.Set(registry->GetSlot(a, agent), false);
+    frame.Set(registry->GetSlot(Label("b")), true);
+    // Rule states are ordered by agent id
+    EXPECT_EQ(0.0, aut->Evaluate(frame, rule_states[0]));
+    EXPECT_EQ(-1.0, aut->Evaluate(frame, rule_states[1]));
+
+    // Labels registered directly extend the table
+    const int slot = registry->Register(Label("c", 3));
+    EXPECT_EQ(slot, registry->GetSlot(registry->GetAgentLabelIndex("c"),
+                                      registry->GetAgentIndex(3)));
+    EXPECT_EQ(-1, registry->GetSlot(registry->GetAgentLabelIndex("c"), agent));
+
+    // Unregistered names and agents, e.g. GetAgentIndex of an unknown agent
+    EXPECT_EQ(-1, registry->GetSlot(registry->GetAgentLabelIndex("b"), agent));
+    EXPECT_EQ(-1, registry->GetSlot(a, registry->GetAgentIndex(4)));
+    EXPECT_EQ(-1, registry->GetSlot(5, agent));
+    EXPECT_THROW(registry->Register(-1, agent), std::out_of_range);
+    EXPECT_THROW(registry->Register(a, -1), std::out_of_range);
+    EXPECT_THROW(registry->Register(a, 3), std::out_of_range);
+    EXPECT_THROW(registry->GetAgentId(-1), std::out_of_range);
+}
+
+TEST(AutomatonTest, evaluate_batch) {
+    RuleMonitorSPtr aut = RuleMonitor::MakeRule("G (a#0 & b)", -1.0f, 0);
+    auto rule_states = aut->MakeRuleState({1, 2, 3});
+    EvaluationMap labels;
+    labels[Label("a", 1)] = true;
+    labels[Label("a", 2)] = false;
+    labels[Label("a", 3)] = true;
+    labels[Label("b")] = true;
+    std::vector<double> penalties = aut->EvaluateBatch(labels, rule_states);
+    ASSERT_EQ(3, penalties.size());
+    EXPECT_EQ(0.0, penalties[0]);
+    EXPECT_EQ(-1.0, penalties[1]);
+    EXPECT_EQ(0.0, penalties[2]);
+    EXPECT_EQ(1, rule_states[1].GetViolationCount());
+
+    // States that are not stored contiguously
+    std::vector<RuleState *> state_ptrs = {&rule_states[2], &rule_states[1]};
+    aut->EvaluateBatch(labels, state_ptrs.data(), state_ptrs.size(),
+                       penalties.data());
+    EXPECT_EQ(0.0, penalties[0]);
+    EXPECT_EQ(-1.0, penalties[1]);
+    EXPECT_EQ(2, rule_states[1].GetViolationCount());
+    EXPECT_EQ(0, rule_states[2].GetViolationCount());
+}
+
+TEST(AutomatonTest, automaton_cache) {
+    AutomatonCache& cache = AutomatonCache::GetInstance();
+    const size_t size = cache.Size();
+    RuleMonitorSPtr aut1 = RuleMonitor::MakeRule("G cached#0", -1.0f, 0);
+    RuleMonitorSPtr aut2 = RuleMonitor::MakeRule("G   cached", -2.0f, 1);
+    ASSERT_EQ(size + 1, cache.Size());
+    EXPECT_EQ(cache.Get("G cached"), cache.Get("G  cached "));
+    RuleState state = aut2->MakeRuleState()[0];
+    EvaluationMap labels;
+    labels[Label("cached")] = false;
+    EXPECT_EQ(-2.0, aut2->Evaluate(labels, state));
+}
+
+TEST(AutomatonTest, serialization) {
+    RuleMonitorSPtr aut = RuleMonitor::MakeRule("G (a#0 & b)", -2.0f, 3);
+    RuleMonitorSPtr restored = RuleMonitor::Deserialize(aut->Serialize());
+    EXPECT_EQ(aut->GetStrFormula(), restored->GetStrFormula());
+    EXPECT_EQ(-2.0, restored->GetWeight());
+    EXPECT_EQ(3, restored->GetPriority());
+    EXPECT_TRUE(restored->IsAgentSpecific());
+    EXPECT_EQ(aut->Serialize(), restored->Serialize());
+
+    auto rule_states = restored->MakeRuleState({1, 2});
+    EvaluationMap labels;
+    labels[Label("a", 1)] = true;
+    labels[Label("a", 2)] = false;
+    labels[Label("b")] = true;
+    EXPECT_EQ(0.0, restored->Evaluate(labels, rule_states[0]));
+    EXPECT_EQ(-2.0, restored->Evaluate(labels, rule_states[1]));
+
+    const char *tmpdir = std::getenv("TEST_TMPDIR");
+    const std::string fname =
+        std::string(tmpdir ? tmpdir : "/tmp") + "/rule_library.bin";
+    RuleLibrary::Save(fname, {aut, RuleMonitor::MakeRule("F label", -1.0f, 0)});
+    auto library = RuleLibrary::Load(fname);
+    ASSERT_EQ(2, library.size());
+    EXPECT_EQ("F label", library[1]->GetStrFormula());
+    RuleState state = library[1]->MakeRuleState()[0];
+    EXPECT_EQ(-1.0, library[1]->FinalTransit(state));
+
+    const std::string shm_name =
+        "/ltl_automaton_test_" + std::to_string(getpid());
+    RuleLibrary::SaveShared(shm_name, {aut});
+    library = RuleLibrary::AttachShared(shm_name);
+    RuleLibrary::UnlinkShared(shm_name);
+    ASSERT_EQ(1, library.size());
+    EXPECT_EQ(aut->Serialize(), library[0]->Serialize());
+    rule_states = library[0]->MakeRuleState({1, 2});
+    EXPECT_EQ(0.0, library[0]->Evaluate(labels, rule_states[0]));
+    EXPECT_EQ(-2.0, library[0]->Evaluate(labels, rule_states[1]));
+}
+
+TEST(AutomatonTest, serialization_corrupt) {
+    RuleMonitorSPtr aut = RuleMonitor::MakeRule("G (a#0 & b)", -2.0f, 3);
+    const std::string data = aut->Serialize();
+    EXPECT_THROW(RuleMonitor::Deserialize(data.substr(0, data.size() - 1)),
+                 std::invalid_argument);
+    EXPECT_THROW(RuleMonitor::Deserialize("no rule"), std::invalid_argument);
+
+    // The AP entry of a#0: name, placeholder index and agent specific flag
+    std::string ap_entry(sizeof(uint64_t), '\0');
+    const uint64_t name_size = 1;
+    std::memcpy(&ap_entry[0], &name_size, sizeof(name_size));
+    ap_entry += "a";
+    const size_t pos = data.find(ap_entry);
+    ASSERT_NE(std::string::npos, pos);
+    const size_t placeholder_pos = pos + ap_entry.size();
+    for (int32_t placeholder : {-1, RuleMonitor::kMaxPlaceholders}) {
+      std::string corrupt = data;
+      std::memcpy(&corrupt[placeholder_pos], &placeholder, sizeof(placeholder));
+      EXPECT_THROW(RuleMonitor::Deserialize(corrupt), std::invalid_argument);
+    }
+    std::string corrupt = data;
+    corrupt[placeholder_pos + sizeof(int32_t)] = 0;
+    EXPECT_THROW(RuleMonitor::Deserialize(corrupt), std::invalid_argument);
+}
+
+TEST(AutomatonTest, library_missing_file) {
+    const char *tmpdir = std::getenv("TEST_TMPDIR");
+    const std::string dir =
+        std::string(tmpdir ? tmpdir : "/tmp") + "/missing_rule_library_dir";
+    EXPECT_THROW(RuleLibrary::Load(dir + "/rules.bin"), std::system_error);
+    EXPECT_THROW(
+        RuleLibrary::Save(dir + "/rules.bin",
+                          {RuleMonitor::MakeRule("G a", -1.0f, 0)}),
+        std::runtime_error);
+    EXPECT_THROW(RuleLibrary::AttachShared("/missing_rule_library"),
+                 std::system_error);
+
+    const std::string empty_fname =
+        std::string(tmpdir ? tmpdir : "/tmp") + "/empty_rule_library.bin";
+    std::ofstream(empty_fname).close();
+    EXPECT_THROW(RuleLibrary::Load(empty_fname), std::invalid_argument);
+    std::remove(empty_fname.c_str());
+}
+
+TEST(AutomatonTest, decided_states) {
+    RuleMonitorSPtr aut = RuleMonitor::MakeRule("F label", -1.0f, 0);
+    RuleState state = aut->MakeRuleState()[0];
+    EXPECT_EQ(RuleMonitor::UNDECIDED, aut->GetVerdict(state.GetCurrentState()));
+    EvaluationMap labels;
+    labels[Label("label")] = true;
+    EXPECT_EQ(0.0, aut->Evaluate(labels, state));
+    EXPECT_EQ(RuleMonitor::SATISFIED, aut->GetVerdict(state.GetCurrentState()));
+    // Labels of decided rule states are not needed anymore
+    EXPECT_EQ(0.0, aut->Evaluate(EvaluationMap(), state));
+    EXPECT_EQ(0.0, aut->FinalTransit(state));
+
+    aut = RuleMonitor::MakeRule("G a", -1.0f, 0);
+    state = aut->MakeRuleState()[0];
+    EXPECT_EQ(RuleMonitor::UNDECIDED, aut->GetVerdict(state.GetCurrentState()));
+    aut = RuleMonitor::MakeRule("G true", -1.0f, 0);
+    state = aut->MakeRuleState()[0];
+    EXPECT_EQ(RuleMonitor::SATISFIED, aut->GetVerdict(state.GetCurrentState()));
+}
+
+TEST(AutomatonTest, large_support) {
+    // The support exceeds the lookup table size, steps are cached
+    RuleMonitorSPtr aut = RuleMonitor::MakeRule(
+        "G (p0 | p1 | p2 | p3 | p4 | p5 | p6 | p7 | p8 | p9 | p10 | p11)",
+        -1.0f, 0);
+    RuleState state = aut->MakeRuleState()[0];
+    for (int round = 0; round < 2; ++round) {
+        for (int i = -1; i < 12; ++i) {
+            EvaluationMap labels;
+            for (int j = 0; j < 12; ++j) {
+                labels[Label("p" + std::to_string(j))] = i == j;
+            }
+            EXPECT_EQ(i < 0 ? -1.0 : 0.0, aut->Evaluate(labels, state));
+        }
+    }
+    EXPECT_EQ(2, state.GetViolationCount());
+}
+
+TEST(AutomatonTest, metrics) {
+    RuleMonitorSPtr aut = RuleMonitor::MakeRule("F label", -1.0f, 0);
+    aut->SetLatencyTracking(true);
+    std::vector<RuleState> states = aut->MakeRuleState();
+    EvaluationMap labels;
+    labels[Label("label")] = false;
+    aut->Evaluate(labels, states[0]);
+    labels[Label("label")] = true;
+    aut->Evaluate(labels, states[0]);
+    // Decided, not stepped anymore
+    aut->Evaluate(labels, states[0]);
+    labels.clear();
+    labels[Label::MakeAlive()] = false;
+    RuleState violated = aut->MakeRuleState()[0];
+    aut->Evaluate(labels, violated);
+
+    RuleMetrics metrics = aut->GetMetrics();
+    EXPECT_EQ(3, metrics.steps);
+    EXPECT_EQ(1, metrics.transitions);
+    EXPECT_EQ(1, metrics.violations);
+    EXPECT_EQ(0, metrics.resets);
+    EXPECT_EQ(2, metrics.instances);
+    uint64_t num_calls = 0;
+    for (uint64_t n : metrics.latency_histogram) {
+        num_calls += n;
+    }
+    EXPECT_EQ(4, num_calls);
+
+    aut->ResetMetrics();
+    EXPECT_EQ(0, aut->GetMetrics().steps);
+}
+
+TEST(AutomatonTest, metrics_threads) {
+    RuleMetricsRecorder recorder;
+    // Slots of exited threads are reused
+    for (int i = 0; i < 500; ++i) {
+        std::thread([&recorder] { recorder.Add(RuleMetricsRecorder::STEPS); })
+            .join();
+    }
+    EXPECT_EQ(500, recorder.Get().steps);
+
+    // More threads alive at once than slots, the others share a shard
+    const size_t num_threads = RuleMetricsRecorder::kMaxThreadSlots + 8;
+    std::atomic<size_t> num_started(0);
+    std::vector<std::thread> threads;
+    for (size_t i = 0; i < num_threads; ++i) {
+        threads.emplace_back([&] {
+            ++num_started;
+            while (num_started < num_threads) {
+                std::this_thread::yield();
+            }
+            for (int n = 0; n < 1000; ++n) {
+                recorder.Add(RuleMetricsRecorder::VIOLATIONS);
+            }
+        });
+    }
+    for (auto& thread : threads) {
+        thread.join();
+    }
+    EXPECT_EQ(num_threads * 1000, recorder.Get().violations);
+}
+
 TEST(AutomatonTest, undefined_label) {
     RuleMonitorSPtr aut =
         RuleMonitor::MakeRule("G label", -1.0f, 0);
@@ -91,6 +494,39 @@ TEST(AutomatonTest, undefined_label) {
     ASSERT_DEATH({ state.GetAutomaton()->Evaluate(labels, state); }, "Missing label \"label\"!");
 }
 
+TEST(AutomatonTest, rule_loader) {
+    std::vector<RuleSpec> specs = {{"G a", -1.0, 0},
+                                   {"G (a#0 & b#1)", -2.0, 1},
+                                   {"F label", -3.0, 2},
+                                   {"G a", -4.0, 3}};
+    RuleLoader loader(specs);
+    ASSERT_EQ(specs.size(), loader.Size());
+    RuleMonitorSPtr rule = loader.GetRule(1).get();
+    EXPECT_TRUE(loader.IsReady(1));
+    EXPECT_EQ(2, rule->GetNumPlaceholders());
+    std::vector<RuleMonitorSPtr> rules = loader.GetAll();
+    ASSERT_EQ(specs.size(), rules.size());
+    for (size_t i = 0; i < specs.size(); ++i) {
+        EXPECT_EQ(specs[i].formula, rules[i]->GetStrFormula());
+        EXPECT_EQ(specs[i].weight, rules[i]->GetWeight());
+        EXPECT_EQ(specs[i].priority, rules[i]->GetPriority());
+    }
+}
+
+TEST(AutomatonTest, rule_loader_invalid_formula) {
+    std::vector<RuleSpec> specs = {{"G (a#0 & b", -1.0, 0},
+                                   {"G a", -4.0, 3}};
+    RuleLoader loader(specs);
+    EXPECT_THROW(loader.GetRule(0).get(), std::invalid_argument);
+    EXPECT_EQ(-4.0, loader.GetRule(1).get()->GetWeight());
+    EXPECT_THROW(loader.GetAll(), std::invalid_argument);
+    // Failed translations are not cached
+    const size_t size = AutomatonCache::GetInstance().Size();
+    EXPECT_THROW(RuleMonitor::MakeRule("G (a#0 & b", -1.0, 0),
+                 std::invalid_argument);
+    EXPECT_EQ(size, AutomatonCache::GetInstance().Size());
+}
+
 TEST(AutomatonTest, persistence) {
     RuleMonitorSPtr aut = RuleMonitor::MakeRule("F (G a)", -1.0f, 0);
     RuleState state = aut->MakeRuleState()[0];
@@ -0,0 +1,114 @@
+// Copyright (c) 2020 Klemens Esterle, Luis Gressenbuch
+//
+// This work is licensed under the terms of the MIT license.
+// For a copy, see <https://opensource.org/licenses/MIT>.
+
+#include "gflags/gflags.h"
+#include "glog/logging.h"
+#include "gtest/gtest.h"
+#include "bark/world/evaluation/ltl/label/label.h"
+#include "ltl/product_monitor.h"
+#include "ltl/rule_monitor.h"
+#include "ltl/violation_log.h"
+
+using namespace ltl;
+using RuleMonitorSPtr = RuleMonitor::RuleMonitorSPtr;
+
+TEST(ProductMonitorTest, matches_individual_rules) {
+  std::vector<RuleMonitorSPtr> rules = {
+      RuleMonitor::MakeRule("G a", -1.0f, 0),
+      RuleMonitor::MakeRule("G (a & b)", -2.0f, 1),
+      RuleMonitor::MakeRule("F label", -4.0f, 2)};
+  ProductMonitor product(rules);
+  ASSERT_EQ(3, product.GetNumRules());
+  EXPECT_EQ(2, product.GetRule(2)->GetPriority());
+  ProductMonitor::State state = product.MakeState();
+  std::vector<RuleState> rule_states;
+  for (const auto& rule : rules) {
+    rule_states.push_back(rule->MakeRuleState()[0]);
+  }
+
+  for (int step = 0; step < 12; ++step) {
+    EvaluationMap labels;
+    labels[Label("a")] = step % 3 != 1;
+    labels[Label("b")] = step % 4 != 2;
+    labels[Label("label")] = step == 5;
+    const std::vector<double> penalties = product.Evaluate(labels, state);
+    for (size_t r = 0; r < rules.size(); ++r) {
+      EXPECT_EQ(rules[r]->Evaluate(labels, rule_states[r]), penalties[r]);
+      EXPECT_EQ(rule_states[r].GetCurrentState(),
+                product.GetRuleState(state, r));
+      EXPECT_EQ(rule_states[r].GetViolationCount(), state.violations[r]);
+    }
+  }
+  const std::vector<double> final_penalties = product.FinalTransit(state);
+  for (size_t r = 0; r < rules.size(); ++r) {
+    EXPECT_EQ(rules[r]->FinalTransit(rule_states[r]), final_penalties[r]);
+  }
+}
+
+TEST(ProductMonitorTest, caches_transitions) {
+  ProductMonitor product({RuleMonitor::MakeRule("G a", -1.0f, 0),
+                          RuleMonitor::MakeRule("G (a & b)", -1.0f, 0)});
+  ProductMonitor::State state = product.MakeState();
+  EvaluationMap labels;
+  labels[Label("a")] = true;
+  labels[Label("b")] = true;
+  for (int i = 0; i < 10; ++i) {
+    product.Evaluate(labels, state);
+  }
+  EXPECT_EQ(1, product.GetNumCachedTransitions());
+  labels[Label("b")] = false;
+  EXPECT_EQ(std::vector<double>({0.0, -1.0}), product.Evaluate(labels, state));
+  EXPECT_EQ(2, product.GetNumCachedTransitions());
+  EXPECT_EQ(std::vector<size_t>({0, 1}), state.violations);
+}
+
+TEST(ProductMonitorTest, caches_by_support) {
+  ProductMonitor product({RuleMonitor::MakeRule("G a", -1.0f, 0),
+                          RuleMonitor::MakeRule("F label", -1.0f, 0)});
+  ProductMonitor::State state = product.MakeState();
+  EvaluationMap labels;
+  labels[Label("a")] = true;
+  labels[Label("label")] = true;
+  product.Evaluate(labels, state);
+  EXPECT_EQ(1, product.GetNumCachedTransitions());
+  // F label is decided, its label no longer distinguishes transitions
+  for (int i = 0; i < 4; ++i) {
+    labels[Label("label")] = i % 2 == 0;
+    product.Evaluate(labels, state);
+  }
+  EXPECT_EQ(2, product.GetNumCachedTransitions());
+}
+
+TEST(ProductMonitorTest, records_cached_steps) {
+  auto rule = RuleMonitor::MakeRule("G a", -1.0f, 0);
+  auto log = std::make_shared<ViolationLog>(8);
+  rule->SetViolationLog(log, 7);
+  ProductMonitor product({rule});
+  ProductMonitor::State state = product.MakeState();
+  EvaluationMap labels;
+  labels[Label("a")] = false;
+  for (int i = 0; i < 3; ++i) {
+    product.Evaluate(labels, state);
+  }
+  EXPECT_EQ(1, product.GetNumCachedTransitions());
+  const RuleMetrics metrics = rule->GetMetrics();
+  EXPECT_EQ(3, metrics.steps);
+  EXPECT_EQ(3, metrics.violations);
+  std::vector<ViolationRecord> records;
+  ASSERT_EQ(3, log->Drain(&records));
+  for (const ViolationRecord& record : records) {
+    EXPECT_EQ(7, record.rule_id);
+    EXPECT_EQ(-1, record.agent_ids[0]);
+  }
+}
+
+int main(int argc, char **argv) {
+  google::AllowCommandLineReparsing();
+  google::ParseCommandLineFlags(&argc, &argv, false);
+  google::InitGoogleLogging(argv[0]);
+  ::testing::InitGoogleTest(&argc, argv);
+  FLAGS_logtostderr = true;
+  return RUN_ALL_TESTS();
+}
@@ -0,0 +1,148 @@
+// Copyright (c) 2020 Klemens Esterle, Luis Gressenbuch
+//
+// This work is licensed under the terms of the MIT license.
+// For a copy, see <https://opensource.org/licenses/MIT>.
+
+#include <atomic>
+#include <stdexcept>
+
+#include "gflags/gflags.h"
+#include "glog/logging.h"
+#include "gtest/gtest.h"
+#include "bark/world/evaluation/ltl/label/label.h"
+#include "ltl/rule_evaluator.h"
+#include "ltl/rule_monitor.h"
+#include "ltl/thread_pool.h"
+
+using namespace ltl;
+using RuleMonitorSPtr = RuleMonitor::RuleMonitorSPtr;
+
+TEST(RuleEvaluatorTest, thread_pool) {
+  ThreadPool pool(4);
+  EXPECT_EQ(4, pool.GetNumThreads());
+  std::atomic<int> sum(0);
+  std::vector<ThreadPool::Task> tasks;
+  for (int i = 1; i <= 100; ++i) {
+    tasks.push_back([&sum, i] { sum += i; });
+  }
+  for (int run = 0; run < 10; ++run) {
+    pool.Run(tasks);
+  }
+  EXPECT_EQ(50500, sum);
+
+  tasks.push_back([] { throw std::runtime_error("task failed"); });
+  EXPECT_THROW(pool.Run(tasks), std::runtime_error);
+  pool.Run({[&sum] { sum = 0; }});
+  EXPECT_EQ(0, sum);
+}
+
+TEST(RuleEvaluatorTest, thread_pool_back_to_back) {
+  // Workers of a batch are still polling when the next one starts
+  ThreadPool pool(8);
+  std::atomic<int> sum(0);
+  std::vector<ThreadPool::Task> tasks(3, [&sum] { ++sum; });
+  for (int run = 0; run < 20000; ++run) {
+    pool.Run(tasks);
+  }
+  EXPECT_EQ(60000, sum);
+
+  std::vector<ThreadPool::Task> failing = {
+      [] {}, [] { throw std::runtime_error("task failed"); }};
+  for (int run = 0; run < 1000; ++run) {
+    EXPECT_THROW(pool.Run(failing), std::runtime_error);
+    pool.Run(tasks);
+  }
+}
+
+TEST(RuleEvaluatorTest, matches_sequential_evaluation) {
+  RuleMonitorSPtr pairwise = RuleMonitor::MakeRule("G (a#0 & b#1)", -1.0f, 0);
+  RuleMonitorSPtr single = RuleMonitor::MakeRule("G (a#0 & b)", -2.0f, 1);
+  RuleMonitorSPtr global = RuleMonitor::MakeRule("G a", -3.0f, 2);
+
+  std::vector<int> agents;
+  for (int id = 0; id < 20; ++id) {
+    agents.push_back(id);
+  }
+  RuleEvaluator evaluator(4, 7);
+  evaluator.AddRule(pairwise);
+  evaluator.AddAgents(agents);
+  evaluator.AddRule(single);
+  evaluator.AddRule(global);
+  ASSERT_EQ(3, evaluator.GetNumRules());
+  ASSERT_EQ(380, evaluator.GetRuleStates(0).Size());
+  ASSERT_EQ(20, evaluator.GetRuleStates(1).Size());
+  ASSERT_EQ(1, evaluator.GetRuleStates(2).Size());
+
+  std::vector<RuleStateSet> sequential = {pairwise->MakeRuleStateSet(agents),
+                                          single->MakeRuleStateSet(agents),
+                                          global->MakeRuleStateSet()};
+  for (int step = 0; step < 5; ++step) {
+    EvaluationMap labels;
+    for (int id : agents) {
+      labels[Label("a", id)] = (id + step) % 3 != 0;
+      labels[Label("b", id)] = (id * step) % 4 != 1;
+    }
+    labels[Label("a")] = step % 2 == 0;
+    labels[Label("b")] = step != 3;
+    const std::vector<double> penalties = evaluator.Evaluate(labels);
+    ASSERT_EQ(3, penalties.size());
+    for (size_t r = 0; r < sequential.size(); ++r) {
+      std::vector<double> expected;
+      EXPECT_EQ(sequential[r].Evaluate(labels, &expected), penalties[r]);
+      EXPECT_EQ(expected, evaluator.GetPenalties(r));
+    }
+  }
+  const std::vector<double> final_penalties = evaluator.FinalTransit();
+  for (size_t r = 0; r < sequential.size(); ++r) {
+    EXPECT_EQ(sequential[r].FinalTransit(), final_penalties[r]);
+  }
+
+  evaluator.RemoveAgents({3});
+  EXPECT_EQ(342, evaluator.GetRuleStates(0).Size());
+  EXPECT_EQ(19, evaluator.GetRuleStates(1).Size());
+}
+
+TEST(RuleEvaluatorTest, snapshot) {
+  RuleMonitorSPtr pairwise = RuleMonitor::MakeRule("G (a#0 & b#1)", -1.0f, 0);
+  RuleMonitorSPtr global = RuleMonitor::MakeRule("G a", -3.0f, 2);
+  RuleEvaluator evaluator(2);
+  evaluator.AddRule(pairwise);
+  evaluator.AddRule(global);
+  evaluator.AddAgents({1, 2, 3});
+  EvaluationMap labels;
+  for (int id = 1; id <= 3; ++id) {
+    labels[Label("a", id)] = id != 2;
+    labels[Label("b", id)] = true;
+  }
+  labels[Label("a")] = false;
+  const RuleEvaluator::Snapshot snapshot = evaluator.SaveSnapshot();
+
+  // Every rollout starts from the snapshot and yields the same penalties
+  std::vector<double> first_rollout;
+  for (int rollout = 0; rollout < 3; ++rollout) {
+    evaluator.RestoreSnapshot(snapshot);
+    if (rollout == 2) {
+      evaluator.RemoveAgents({3});
+    }
+    const std::vector<double> penalties = evaluator.Evaluate(labels);
+    if (rollout == 0) {
+      first_rollout = penalties;
+      EXPECT_EQ(std::vector<double>({-2.0, -3.0}), penalties);
+    } else if (rollout == 1) {
+      EXPECT_EQ(first_rollout, penalties);
+    }
+    EXPECT_EQ(1, evaluator.GetRuleStates(1).GetViolationCount(0));
+  }
+  evaluator.RestoreSnapshot(snapshot);
+  EXPECT_EQ(6, evaluator.GetRuleStates(0).Size());
+  EXPECT_EQ(first_rollout, evaluator.Evaluate(labels));
+}
+
+int main(int argc, char **argv) {
+  google::AllowCommandLineReparsing();
+  google::ParseCommandLineFlags(&argc, &argv, false);
+  google::InitGoogleLogging(argv[0]);
+  ::testing::InitGoogleTest(&argc, argv);
+  FLAGS_logtostderr = true;
+  return RUN_ALL_TESTS();
+}
@@ -0,0 +1,85 @@
+// Copyright (c) 2020 Klemens Esterle, Luis Gressenbuch
+//
+// This work is licensed under the terms of the MIT license.
+// For a copy, see <https://opensource.org/licenses/MIT>.
+
+#include "gflags/gflags.h"
+#include "glog/logging.h"
+#include "gtest/gtest.h"
+#include "bark/world/evaluation/ltl/label/label.h"
+#include "ltl/rule_monitor.h"
+#include "ltl/rule_state_arena.h"
+
+using namespace ltl;
+using RuleMonitorSPtr = RuleMonitor::RuleMonitorSPtr;
+
+TEST(RuleStateArenaTest, matches_rule_states) {
+  RuleMonitorSPtr pairwise = RuleMonitor::MakeRule("G (a#0 & b#1)", -1.0f, 0);
+  RuleMonitorSPtr global = RuleMonitor::MakeRule("G label", -2.0f, 0);
+  const std::vector<int> agents = {1, 2, 3};
+  RuleStateArena arena;
+  EXPECT_EQ(6, arena.AddAgents(*pairwise, agents));
+  EXPECT_EQ(1, arena.AddAgents(*global, agents));
+  ASSERT_EQ(7, arena.Size());
+  std::vector<RuleState> expected = pairwise->MakeRuleState(agents);
+  ASSERT_EQ(6, expected.size());
+  for (size_t i = 0; i < expected.size(); ++i) {
+    EXPECT_EQ(expected[i].GetAgentIds(),
+              std::vector<int>(arena.GetAgentIds(i), arena.GetAgentIds(i) + 2));
+  }
+  EXPECT_EQ(global.get(), &arena.GetRule(6));
+
+  EvaluationMap labels;
+  for (int id : agents) {
+    labels[Label("a", id)] = id != 2;
+    labels[Label("b", id)] = true;
+  }
+  labels[Label("label")] = false;
+  std::vector<double> penalties(arena.Size());
+  const double sum = arena.Evaluate(labels, 0, arena.Size(), penalties.data());
+  std::vector<double> expected_penalties =
+      pairwise->EvaluateBatch(labels, expected);
+  expected_penalties.push_back(-2.0);
+  EXPECT_EQ(expected_penalties, penalties);
+  EXPECT_EQ(-4.0, sum);
+  for (size_t i = 0; i < expected.size(); ++i) {
+    EXPECT_EQ(expected[i].GetCurrentState(), arena.GetCurrentState(i));
+    EXPECT_EQ(expected[i].GetViolationCount(), arena.GetViolationCount(i));
+    EXPECT_EQ(pairwise->FinalTransit(expected[i]), arena.FinalTransit(i));
+  }
+  EXPECT_EQ(1, arena.GetViolationCount(6));
+
+  // A new episode reuses the memory, handles start from zero again
+  arena.Reset();
+  EXPECT_EQ(0, arena.Size());
+  EXPECT_EQ(1, arena.AddAgents(*global, {}));
+  EXPECT_EQ(0, arena.GetViolationCount(0));
+}
+
+TEST(RuleStateArenaTest, evaluate_frame) {
+  auto registry = std::make_shared<LabelRegistry>();
+  RuleMonitorSPtr aut = RuleMonitor::MakeRule("G (a#0 & b)", -1.0f, 0);
+  aut->BindLabels(registry);
+  RuleStateArena arena;
+  const int agent_ids[] = {1, 2};
+  const RuleStateArena::Handle first = arena.Add(*aut, &agent_ids[0]);
+  const RuleStateArena::Handle second = arena.Add(*aut, &agent_ids[1]);
+  LabelFrame frame(*registry);
+  frame.Set(registry->GetSlot(Label("a", 1)), false);
+  frame.Set(registry->GetSlot(Label("a", 2)), true);
+  frame.Set(registry->GetSlot(Label("b")), true);
+  EXPECT_EQ(-1.0, arena.Evaluate(frame, first));
+  EXPECT_EQ(0.0, arena.Evaluate(frame, second));
+  EXPECT_EQ(1, arena.GetViolationCount(first));
+  EXPECT_EQ(0, arena.GetViolationCount(second));
+  ASSERT_DEATH({ arena.Add(*aut); }, "needs an agent tuple");
+}
+
+int main(int argc, char **argv) {
+  google::AllowCommandLineReparsing();
+  google::ParseCommandLineFlags(&argc, &argv, false);
+  google::InitGoogleLogging(argv[0]);
+  ::testing::InitGoogleTest(&argc, argv);
+  FLAGS_logtostderr = true;
+  return RUN_ALL_TESTS();
+}
@@ -0,0 +1,350 @@
+// Copyright (c) 2020 Klemens Esterle, Luis Gressenbuch
+//
+// This work is licensed under the terms of the MIT license.
+// For a copy, see <https://opensource.org/licenses/MIT>.
+
+#include <set>
+
+#include "gflags/gflags.h"
+#include "glog/logging.h"
+#include "gtest/gtest.h"
+#include "bark/world/evaluation/ltl/label/label.h"
+#include "ltl/proximity_filter.h"
+#include "ltl/rule_monitor.h"
+#include "ltl/rule_state_set.h"
+
+using namespace ltl;
+using RuleMonitorSPtr = RuleMonitor::RuleMonitorSPtr;
+
+TEST(RuleStateSetTest, make_rule_state_set) {
+  RuleMonitorSPtr aut = RuleMonitor::MakeRule("G (a#0 & b#1)", -1.0f, 0);
+  RuleStateSet set = aut->MakeRuleStateSet({1, 2});
+  ASSERT_EQ(2, set.Size());
+  ASSERT_EQ(2, set.GetArity());
+  EXPECT_EQ(1, set.GetAgentIds(0)[0]);
+  EXPECT_EQ(2, set.GetAgentIds(0)[1]);
+  EXPECT_EQ(2, set.GetAgentIds(1)[0]);
+  EXPECT_EQ(1, set.GetAgentIds(1)[1]);
+  RuleState state = set.GetRuleState(1);
+  EXPECT_EQ(std::vector<int>({2, 1}), state.GetAgentIds());
+
+  aut = RuleMonitor::MakeRule("G a", -1.0f, 0);
+  set = aut->MakeRuleStateSet();
+  ASSERT_EQ(1, set.Size());
+  ASSERT_EQ(0, set.GetArity());
+}
+
+TEST(RuleStateSetTest, evaluate) {
+  RuleMonitorSPtr aut = RuleMonitor::MakeRule("G (a#0 & b)", -1.0f, 0);
+  RuleStateSet set = aut->MakeRuleStateSet({1, 2, 3});
+  EvaluationMap labels;
+  labels[Label("a", 1)] = true;
+  labels[Label("a", 2)] = false;
+  labels[Label("a", 3)] = true;
+  labels[Label("b")] = true;
+  std::vector<double> penalties;
+  EXPECT_EQ(-1.0, set.Evaluate(labels, &penalties));
+  EXPECT_EQ(std::vector<double>({0.0, -1.0, 0.0}), penalties);
+  EXPECT_EQ(1, set.GetViolationCount(1));
+  EXPECT_EQ(0.0, set.FinalTransit());
+
+  set.Remove(0);
+  ASSERT_EQ(2, set.Size());
+  EXPECT_EQ(3, set.GetAgentIds(0)[0]);
+  EXPECT_EQ(1, set.GetViolationCount(1));
+}
+
+TEST(RuleStateSetTest, evaluate_frame) {
+  auto registry = std::make_shared<LabelRegistry>();
+  RuleMonitorSPtr aut = RuleMonitor::MakeRule("G (a#0 & b)", -1.0f, 0);
+  aut->BindLabels(registry);
+  RuleStateSet set = aut->MakeRuleStateSet({1, 2});
+  LabelFrame frame(*registry);
+  frame.Set(registry->GetSlot(Label("a", 1)), false);
+  frame.Set(registry->GetSlot(Label("a", 2)), true);
+  frame.Set(registry->GetSlot(Label("b")), true);
+  std::vector<double> penalties;
+  EXPECT_EQ(-1.0, set.Evaluate(frame, &penalties));
+  EXPECT_EQ(std::vector<double>({-1.0, 0.0}), penalties);
+}
+
+TEST(RuleStateSetTest, add_remove_agents) {
+  RuleMonitorSPtr aut = RuleMonitor::MakeRule("G (a#0 & b#1)", -1.0f, 0);
+  RuleStateSet set = aut->MakeRuleStateSet({1, 2});
+  set.AddAgents({2, 3});
+  ASSERT_EQ(6, set.Size());
+  EXPECT_EQ(std::vector<int>({1, 2, 3}), set.GetAgents());
+
+  EvaluationMap labels;
+  for (int id = 1; id <= 3; ++id) {
+    labels[Label("a", id)] = true;
+    labels[Label("b", id)] = id != 2;
+  }
+  set.Evaluate(labels);
+
+  std::vector<std::vector<int>> retired;
+  set.RemoveAgents({2}, [&](const RuleState &state, double) {
+    retired.push_back(state.GetAgentIds());
+    EXPECT_EQ(state.GetAgentIds()[1] == 2 ? 1 : 0, state.GetViolationCount());
+  });
+  EXPECT_EQ(4, retired.size());
+  ASSERT_EQ(2, set.Size());
+  EXPECT_EQ(std::vector<int>({1, 3}), set.GetAgents());
+  for (size_t i = 0; i < set.Size(); ++i) {
+    EXPECT_NE(2, set.GetAgentIds(i)[0]);
+    EXPECT_NE(2, set.GetAgentIds(i)[1]);
+    EXPECT_EQ(0, set.GetViolationCount(i));
+  }
+  set.RemoveAgents({1, 3});
+  EXPECT_EQ(0, set.Size());
+}
+
+TEST(RuleStateSetTest, add_repeated_agent) {
+  RuleMonitorSPtr aut = RuleMonitor::MakeRule("G (a#0 & b#1)", -1.0f, 0);
+  RuleStateSet set = aut->MakeRuleStateSet({});
+  EXPECT_EQ(0, set.Add({1, 2}));
+  ASSERT_DEATH({ set.Add({1, 1}); }, "distinct agents");
+}
+
+TEST(RuleStateSetTest, incremental_rule_state) {
+  RuleMonitorSPtr aut = RuleMonitor::MakeRule("G (a#0 & b#1)", -1.0f, 0);
+  auto rule_states = aut->MakeRuleState({3}, {1, 2});
+  ASSERT_EQ(4, rule_states.size());
+  EXPECT_EQ(std::vector<int>({1, 3}), rule_states[0].GetAgentIds());
+  EXPECT_EQ(std::vector<int>({2, 3}), rule_states[1].GetAgentIds());
+  EXPECT_EQ(std::vector<int>({3, 1}), rule_states[2].GetAgentIds());
+  EXPECT_EQ(std::vector<int>({3, 2}), rule_states[3].GetAgentIds());
+  EXPECT_TRUE(aut->MakeRuleState({1}, {1, 2}).empty());
+}
+
+TEST(RuleStateSetTest, relevance_filter) {
+  RuleMonitorSPtr aut = RuleMonitor::MakeRule("G (a#0 & b#1)", -1.0f, 0);
+  auto positions = std::make_shared<ProximityFilter>(10.0);
+  positions->SetPosition(1, 0.0, 0.0);
+  positions->SetPosition(2, 5.0, 0.0);
+  positions->SetPosition(3, 100.0, 0.0);
+  RuleStateSet set(aut);
+  set.SetRelevanceFilter(ProximityFilter::Bind(positions));
+  set.AddAgents({1, 2, 3});
+  // Irrelevant tuples are not instantiated at all
+  EXPECT_EQ(2, set.Size());
+  EXPECT_EQ(0, set.GetNumParked());
+
+  EvaluationMap labels;
+  labels[Label("a", 1)] = true;
+  labels[Label("b", 2)] = false;
+  labels[Label("a", 2)] = true;
+  labels[Label("b", 1)] = true;
+  set.Evaluate(labels);
+
+  // Agent 2 moves away from 1 and towards 3, only the violated tuple (1, 2)
+  // differs from a fresh instance and is parked
+  positions->SetPosition(2, 95.0, 0.0);
+  set.UpdateRelevance();
+  EXPECT_EQ(2, set.Size());
+  EXPECT_EQ(1, set.GetNumParked());
+  for (size_t i = 0; i < set.Size(); ++i) {
+    EXPECT_NE(1, set.GetAgentIds(i)[0]);
+    EXPECT_NE(1, set.GetAgentIds(i)[1]);
+  }
+
+  // Agent 2 returns, its violation count is restored
+  positions->SetPosition(2, 5.0, 0.0);
+  set.UpdateRelevance();
+  EXPECT_EQ(2, set.Size());
+  EXPECT_EQ(0, set.GetNumParked());
+  size_t violations = 0;
+  for (size_t i = 0; i < set.Size(); ++i) {
+    violations += set.GetViolationCount(i);
+  }
+  EXPECT_EQ(1, violations);
+
+  positions->SetPosition(2, 95.0, 0.0);
+  set.UpdateRelevance();
+  EXPECT_EQ(1, set.GetNumParked());
+  set.RemoveAgents({1});
+  EXPECT_EQ(2, set.Size());
+  EXPECT_EQ(0, set.GetNumParked());
+}
+
+TEST(RuleStateSetTest, relevance_neighbor_query) {
+  RuleMonitorSPtr aut = RuleMonitor::MakeRule("G (a#0 & b#1)", -1.0f, 0);
+  auto positions = std::make_shared<ProximityFilter>(10.0);
+  std::vector<int> agents;
+  // Pairs of close agents, far away from all other pairs
+  for (int id = 0; id < 200; ++id) {
+    positions->SetPosition(id, 100.0 * (id / 2) + 5.0 * (id % 2), 0.0);
+    agents.push_back(id);
+  }
+  size_t num_calls = 0;
+  auto filter = ProximityFilter::Bind(positions);
+  RuleStateSet set(aut);
+  set.SetRelevanceFilter(
+      [&](const int* agent_ids, size_t arity) {
+        ++num_calls;
+        return filter(agent_ids, arity);
+      },
+      ProximityFilter::BindNeighbors(positions));
+  set.AddAgents(agents);
+  EXPECT_EQ(200, set.Size());
+  EXPECT_EQ(200, num_calls);
+
+  // Agents without a position may interact with all agents
+  positions->RemoveAgent(0);
+  set.UpdateRelevance();
+  EXPECT_EQ(200 + 2 * 198, set.Size());
+}
+
+TEST(RuleStateSetTest, relevance_final_penalty) {
+  RuleMonitorSPtr aut = RuleMonitor::MakeRule("F label#0", -1.0f, 0);
+  std::set<int> relevant = {1, 2};
+  RuleStateSet set(aut);
+  set.SetRelevanceFilter([&relevant](const int* agent_ids, size_t) {
+    return relevant.count(agent_ids[0]) > 0;
+  });
+  set.AddAgents({1, 2});
+  EvaluationMap labels;
+  labels[Label("label", 1)] = true;
+  labels[Label("label", 2)] = false;
+  set.Evaluate(labels);
+  std::vector<double> penalties;
+  const double expected = set.FinalTransit(&penalties);
+  EXPECT_NE(0.0, expected);
+
+  // The satisfied instance of agent 1 is parked but still counts
+  relevant.erase(1);
+  set.UpdateRelevance();
+  ASSERT_EQ(1, set.Size());
+  ASSERT_EQ(1, set.GetNumParked());
+  EXPECT_EQ(expected, set.FinalTransit(&penalties));
+  ASSERT_EQ(2, penalties.size());
+  EXPECT_EQ(0.0, penalties[1]);
+  EXPECT_EQ(0.0, set.GetFinalPenalty(1));
+}
+
+TEST(RuleStateSetTest, evaluate_trace) {
+  auto registry = std::make_shared<LabelRegistry>();
+  RuleMonitorSPtr aut = RuleMonitor::MakeRule("G (a#0 & b)", -1.0f, 0);
+  aut->BindLabels(registry);
+  std::vector<int> agents;
+  for (int id = 0; id < 11; ++id) {
+    agents.push_back(id);
+  }
+  RuleStateSet set = aut->MakeRuleStateSet(agents);
+  RuleStateSet expected_set = aut->MakeRuleStateSet(agents);
+  const size_t num_steps = 6;
+  LabelTrace trace(num_steps, *registry);
+  ASSERT_EQ(registry->GetNumSlots(), trace.GetNumSlots());
+  for (size_t t = 0; t < num_steps; ++t) {
+    for (int id : agents) {
+      trace.Set(t, registry->GetSlot(Label("a", id)), (id + t) % 4 != 0);
+    }
+    trace.Set(t, registry->GetSlot(Label("b")), t != 2);
+  }
+  RuleStateSet::TraceResult result;
+  set.EvaluateTrace(trace, &result);
+  ASSERT_EQ(num_steps, result.step_penalties.size());
+
+  size_t num_violations = 0;
+  LabelFrame frame;
+  for (size_t t = 0; t < num_steps; ++t) {
+    trace.GetFrame(t, &frame);
+    std::vector<double> penalties;
+    EXPECT_EQ(expected_set.Evaluate(frame, &penalties),
+              result.step_penalties[t]);
+    for (size_t i = 0; i < penalties.size(); ++i) {
+      if (penalties[i] != 0.0) {
+        ASSERT_LT(num_violations, result.violations.size());
+        EXPECT_EQ(t, result.violations[num_violations].step);
+        EXPECT_EQ(i, result.violations[num_violations].instance);
+        ++num_violations;
+      }
+    }
+  }
+  EXPECT_EQ(num_violations, result.violations.size());
+  for (size_t i = 0; i < set.Size(); ++i) {
+    EXPECT_EQ(expected_set.GetCurrentState(i), set.GetCurrentState(i));
+    EXPECT_EQ(expected_set.GetViolationCount(i), set.GetViolationCount(i));
+  }
+}
+
+TEST(RuleStateSetTest, evaluate_delta) {
+  auto registry = std::make_shared<LabelRegistry>();
+  RuleMonitorSPtr aut = RuleMonitor::MakeRule("G (a#0 & b)", -1.0f, 0);
+  aut->BindLabels(registry);
+  std::vector<int> agents = {0, 1, 2, 3, 4};
+  RuleStateSet set = aut->MakeRuleStateSet(agents);
+  RuleStateSet expected_set = aut->MakeRuleStateSet(agents);
+  const int b_slot = registry->GetSlot(Label("b"));
+
+  // The frame is reused, only the labels set in a step are marked as changed
+  LabelFrame frame(registry->GetNumSlots());
+  frame.MarkAllChanged();
+  for (size_t t = 0; t < 8; ++t) {
+    for (int id : agents) {
+      if (t == 0 || (id + t) % 3 == 0) {
+        frame.Set(registry->GetSlot(Label("a", id)), (id + t) % 4 != 0);
+      }
+    }
+    frame.Set(b_slot, t != 5);
+    LabelFrame expected_frame(registry->GetNumSlots());
+    for (size_t slot = 0; slot < frame.GetNumSlots(); ++slot) {
+      expected_frame.Set(slot, frame.Get(slot));
+    }
+    std::vector<double> penalties, expected_penalties;
+    EXPECT_EQ(expected_set.Evaluate(expected_frame, &expected_penalties),
+              set.EvaluateDelta(frame, &penalties));
+    EXPECT_EQ(expected_penalties, penalties);
+    frame.ClearChanges();
+  }
+  for (size_t i = 0; i < set.Size(); ++i) {
+    EXPECT_EQ(expected_set.GetCurrentState(i), set.GetCurrentState(i));
+    EXPECT_EQ(expected_set.GetViolationCount(i), set.GetViolationCount(i));
+  }
+}
+
+TEST(RuleStateSetTest, snapshot) {
+  RuleMonitorSPtr aut = RuleMonitor::MakeRule("G (a#0 & b)", -1.0f, 0);
+  RuleStateSet set = aut->MakeRuleStateSet({1, 2, 3});
+  EvaluationMap labels;
+  labels[Label("a", 1)] = true;
+  labels[Label("a", 2)] = false;
+  labels[Label("a", 3)] = true;
+  labels[Label("b")] = true;
+  set.Evaluate(labels);
+  const RuleStateSet::Snapshot snapshot = set.SaveSnapshot();
+
+  // Snapshots share the agent tuples while no instance is added or removed
+  set.Evaluate(labels);
+  RuleStateSet::Snapshot branch;
+  set.SaveSnapshot(&branch);
+  EXPECT_EQ(snapshot.layout, branch.layout);
+  EXPECT_EQ(2, set.GetViolationCount(1));
+  set.RestoreSnapshot(snapshot);
+  EXPECT_EQ(1, set.GetViolationCount(1));
+  set.RestoreSnapshot(branch);
+  EXPECT_EQ(2, set.GetViolationCount(1));
+
+  set.RemoveAgents({2});
+  ASSERT_EQ(2, set.Size());
+  set.SaveSnapshot(&branch);
+  EXPECT_NE(snapshot.layout, branch.layout);
+  set.RestoreSnapshot(snapshot);
+  ASSERT_EQ(3, set.Size());
+  EXPECT_EQ(std::vector<int>({1, 2, 3}), set.GetAgents());
+  EXPECT_EQ(2, set.GetAgentIds(1)[0]);
+  EXPECT_EQ(1, set.GetViolationCount(1));
+  // The restored index of agents allows removing them again
+  set.RemoveAgents({1});
+  EXPECT_EQ(2, set.Size());
+  EXPECT_EQ(-1.0, set.Evaluate(labels));
+}
+
+int main(int argc, char **argv) {
+  google::AllowCommandLineReparsing();
+  google::ParseCommandLineFlags(&argc, &argv, false);
+  google::InitGoogleLogging(argv[0]);
+  ::testing::InitGoogleTest(&argc, argv);
+  FLAGS_logtostderr = true;
+  return RUN_ALL_TESTS();
+}
@@ -0,0 +1,162 @@
+// Copyright (c) 2020 Klemens Esterle, Luis Gressenbuch
+//
+// This work is licensed under the terms of the MIT license.
+// For a copy, see <https://opensource.org/licenses/MIT>.
+
+#include <thread>
+
+#include "gflags/gflags.h"
+#include "glog/logging.h"
+#include "gtest/gtest.h"
+#include "bark/world/evaluation/ltl/label/label.h"
+#include "ltl/label_frame.h"
+#include "ltl/rule_monitor.h"
+#include "ltl/rule_state_set.h"
+#include "ltl/violation_log.h"
+
+using namespace ltl;
+using RuleMonitorSPtr = RuleMonitor::RuleMonitorSPtr;
+
+namespace {
+ViolationRecord MakeRecord(uint32_t rule_id) {
+  ViolationRecord record{};
+  record.rule_id = rule_id;
+  return record;
+}
+}  // namespace
+
+TEST(ViolationLogTest, drop_when_full) {
+  ViolationLog log(3);
+  ASSERT_EQ(4, log.GetCapacity());
+  log.SetStep(7);
+  for (uint32_t i = 0; i < 6; ++i) {
+    EXPECT_EQ(i < 4, log.Push(MakeRecord(i)));
+  }
+  EXPECT_EQ(2, log.GetNumDropped());
+  ViolationRecord records[3];
+  ASSERT_EQ(3, log.Drain(records, 3));
+  EXPECT_EQ(0, records[0].rule_id);
+  EXPECT_EQ(7, records[0].step);
+  EXPECT_EQ(2, records[2].rule_id);
+
+  // Wrap around
+  EXPECT_TRUE(log.Push(MakeRecord(10)));
+  std::vector<ViolationRecord> rest;
+  ASSERT_EQ(2, log.Drain(&rest));
+  EXPECT_EQ(3, rest[0].rule_id);
+  EXPECT_EQ(10, rest[1].rule_id);
+  EXPECT_EQ(0, log.Drain(&rest));
+}
+
+TEST(ViolationLogTest, concurrent_producers) {
+  ViolationLog log(64, ViolationLog::BLOCK);
+  const uint32_t num_threads = 4;
+  const uint32_t num_records = 1000;
+  std::vector<std::thread> producers;
+  for (uint32_t t = 0; t < num_threads; ++t) {
+    producers.emplace_back([&log, t, num_records] {
+      for (uint32_t i = 0; i < num_records; ++i) {
+        log.Push(MakeRecord(t));
+      }
+    });
+  }
+  std::vector<size_t> counts(num_threads, 0);
+  size_t num_drained = 0;
+  std::vector<ViolationRecord> records;
+  while (num_drained < num_threads * num_records) {
+    records.clear();
+    num_drained += log.Drain(&records);
+    for (const auto& record : records) {
+      ++counts[record.rule_id];
+    }
+  }
+  for (auto& producer : producers) {
+    producer.join();
+  }
+  EXPECT_EQ(std::vector<size_t>(num_threads, num_records), counts);
+  EXPECT_EQ(0, log.GetNumDropped());
+}
+
+TEST(ViolationLogTest, rule_state_set) {
+  RuleMonitorSPtr aut = RuleMonitor::MakeRule("G (a#0 & b)", -1.0f, 0);
+  auto log = std::make_shared<ViolationLog>(16);
+  aut->SetViolationLog(log, 5);
+  RuleStateSet set = aut->MakeRuleStateSet({1, 2, 3});
+  EvaluationMap labels;
+  labels[Label("a", 1)] = true;
+  labels[Label("a", 2)] = false;
+  labels[Label("a", 3)] = true;
+  labels[Label("b")] = true;
+  log->SetStep(1);
+  set.Evaluate(labels);
+  labels[Label("a", 3)] = false;
+  log->SetStep(2);
+  set.Evaluate(labels);
+
+  std::vector<ViolationRecord> records;
+  ASSERT_EQ(3, log->Drain(&records));
+  EXPECT_EQ(1, records[0].step);
+  EXPECT_EQ(5, records[0].rule_id);
+  EXPECT_EQ(2, records[0].agent_ids[0]);
+  EXPECT_EQ(-1, records[0].agent_ids[1]);
+  EXPECT_EQ(set.GetCurrentState(0), records[0].automaton_state);
+  EXPECT_EQ(2, records[1].step);
+  EXPECT_EQ(2, records[1].agent_ids[0]);
+  EXPECT_EQ(2, records[2].step);
+  EXPECT_EQ(3, records[2].agent_ids[0]);
+
+  aut->SetViolationLog(nullptr, 0);
+  set.Evaluate(labels);
+  EXPECT_EQ(0, log->Drain(&records));
+}
+
+TEST(ViolationLogTest, evaluate_trace) {
+  auto registry = std::make_shared<LabelRegistry>();
+  RuleMonitorSPtr aut = RuleMonitor::MakeRule("G (a#0 & b)", -1.0f, 0);
+  aut->BindLabels(registry);
+  auto log = std::make_shared<ViolationLog>(16);
+  aut->SetViolationLog(log, 5);
+  RuleStateSet set = aut->MakeRuleStateSet({1, 2});
+  LabelTrace trace(4, *registry);
+  for (size_t t = 0; t < 4; ++t) {
+    trace.Set(t, registry->GetSlot(Label("a", 1)), true);
+    trace.Set(t, registry->GetSlot(Label("a", 2)), t != 2);
+    trace.Set(t, registry->GetSlot(Label("b")), true);
+  }
+  log->SetStep(100);
+  RuleStateSet::TraceResult result;
+  set.EvaluateTrace(trace, &result);
+
+  // Stamped with the step within the trace, not the step of the log
+  std::vector<ViolationRecord> records;
+  ASSERT_EQ(1, log->Drain(&records));
+  EXPECT_EQ(2, records[0].step);
+  EXPECT_EQ(2, records[0].agent_ids[0]);
+}
+
+TEST(ViolationLogTest, drain_at_most_capacity) {
+  ViolationLog log(4, ViolationLog::BLOCK);
+  std::atomic<bool> stop(false);
+  std::thread producer([&] {
+    while (!stop) {
+      log.Push(MakeRecord(0));
+    }
+  });
+  // Terminates although the producer keeps refilling the log
+  std::vector<ViolationRecord> records;
+  for (int i = 0; i < 100; ++i) {
+    EXPECT_LE(log.Drain(&records), log.GetCapacity());
+  }
+  stop = true;
+  log.Drain(&records);
+  producer.join();
+}
+
+int main(int argc, char **argv) {
+  google::AllowCommandLineReparsing();
+  google::ParseCommandLineFlags(&argc, &argv, false);
+  google::InitGoogleLogging(argv[0]);
+  ::testing::InitGoogleTest(&argc, argv);
+  FLAGS_logtostderr = true;
+  return RUN_ALL_TESTS();
+}
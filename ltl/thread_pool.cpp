@@ -0,0 +1,130 @@
+// Copyright (c) 2020 Klemens Esterle, Luis Gressenbuch
+//
+// This work is licensed under the terms of the MIT license.
+// For a copy, see <https://opensource.org/licenses/MIT>.
+
+#include "ltl/thread_pool.h"
+
+#include <algorithm>
+
+namespace ltl {
+
+ThreadPool::ThreadPool(size_t num_threads)
+    : generation_(0), stop_(false), pending_(0) {
+  if (num_threads == 0) {
+    num_threads = std::max(1u, std::thread::hardware_concurrency());
+  }
+  for (size_t i = 0; i < num_threads; ++i) {
+    queues_.emplace_back(new Queue());
+  }
+  // Queue 0 belongs to the thread calling Run
+  for (size_t i = 1; i < num_threads; ++i) {
+    workers_.emplace_back(&ThreadPool::WorkerLoop, this, i);
+  }
+}
+
+ThreadPool::~ThreadPool() {
+  {
+    std::lock_guard<std::mutex> lock(mutex_);
+    stop_ = true;
+  }
+  work_cv_.notify_all();
+  for (std::thread& worker : workers_) {
+    worker.join();
+  }
+}
+
+void ThreadPool::Run(const std::vector<Task>& tasks) {
+  if (tasks.empty()) {
+    return;
+  }
+  std::lock_guard<std::mutex> run_lock(run_mutex_);
+  // Workers of the previous batch may still be polling the queues, so the
+  // batch state has to be set before the first task becomes visible
+  {
+    std::lock_guard<std::mutex> lock(mutex_);
+    pending_ = tasks.size();
+    error_ = nullptr;
+    ++generation_;
+  }
+  for (size_t i = 0; i < tasks.size(); ++i) {
+    Queue& queue = *queues_[i % queues_.size()];
+    std::lock_guard<std::mutex> lock(queue.mutex);
+    queue.tasks.push_back(&tasks[i]);
+  }
+  work_cv_.notify_all();
+  while (RunOne(0)) {
+  }
+  std::exception_ptr error;
+  {
+    std::unique_lock<std::mutex> lock(mutex_);
+    done_cv_.wait(lock, [this] { return pending_ == 0; });
+    std::swap(error, error_);
+  }
+  if (error) {
+    std::rethrow_exception(error);
+  }
+}
+
+size_t ThreadPool::GetNumThreads() const { return queues_.size(); }
+
+void ThreadPool::WorkerLoop(size_t thread_idx) {
+  size_t generation = 0;
+  while (true) {
+    {
+      std::unique_lock<std::mutex> lock(mutex_);
+      work_cv_.wait(lock,
+                    [&] { return stop_ || generation != generation_; });
+      if (stop_) {
+        return;
+      }
+      generation = generation_;
+    }
+    while (RunOne(thread_idx)) {
+    }
+  }
+}
+
+bool ThreadPool::RunOne(size_t thread_idx) {
+  const Task* task = Pop(thread_idx);
+  if (!task) {
+    return false;
+  }
+  try {
+    (*task)();
+  } catch (...) {
+    std::lock_guard<std::mutex> lock(mutex_);
+    if (!error_) {
+      error_ = std::current_exception();
+    }
+  }
+  if (--pending_ == 0) {
+    std::lock_guard<std::mutex> lock(mutex_);
+    done_cv_.notify_all();
+  }
+  return true;
+}
+
+const ThreadPool::Task* ThreadPool::Pop(size_t thread_idx) {
+  {
+    Queue& own = *queues_[thread_idx];
+    std::lock_guard<std::mutex> lock(own.mutex);
+    if (!own.tasks.empty()) {
+      const Task* task = own.tasks.front();
+      own.tasks.pop_front();
+      return task;
+    }
+  }
+  for (size_t i = 1; i < queues_.size(); ++i) {
+    Queue& victim = *queues_[(thread_idx + i) % queues_.size()];
+    std::lock_guard<std::mutex> lock(victim.mutex);
+    if (!victim.tasks.empty()) {
+      const Task* task = victim.tasks.back();
+      victim.tasks.pop_back();
+      return task;
+    }
+  }
+  return nullptr;
+}
+
+}  // namespace ltl
@@ -0,0 +1,70 @@
+// Copyright (c) 2020 Klemens Esterle, Luis Gressenbuch
+//
+// This work is licensed under the terms of the MIT license.
+// For a copy, see <https://opensource.org/licenses/MIT>.
+
+#ifndef LTL_THREAD_POOL_H_
+#define LTL_THREAD_POOL_H_
+
+#include <atomic>
+#include <condition_variable>
+#include <deque>
+#include <exception>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+namespace ltl {
+
+/// Fixed-size pool of worker threads executing batches of tasks.
+///
+/// Every thread owns a task queue. Tasks of a batch are dealt round-robin to
+/// the queues; a thread pops from the front of its own queue and steals from
+/// the back of the others when it runs dry. The thread calling Run takes part
+/// in the execution.
+class ThreadPool {
+ public:
+  typedef std::function<void()> Task;
+
+  /// \param num_threads Total number of threads including the caller of Run,
+  /// 0 for the number of hardware threads
+  explicit ThreadPool(size_t num_threads = 0);
+  ~ThreadPool();
+  ThreadPool(const ThreadPool&) = delete;
+  ThreadPool& operator=(const ThreadPool&) = delete;
+
+  /// Execute all tasks and block until they are finished. The first exception
+  /// thrown by a task is rethrown after the whole batch completed.
+  void Run(const std::vector<Task>& tasks);
+  size_t GetNumThreads() const;
+
+ private:
+  struct Queue {
+    std::mutex mutex;
+    std::deque<const Task*> tasks;
+  };
+
+  void WorkerLoop(size_t thread_idx);
+  /// Run one task of the own queue or stolen from another one.
+  /// \return False if all queues are empty
+  bool RunOne(size_t thread_idx);
+  const Task* Pop(size_t thread_idx);
+
+  std::vector<std::unique_ptr<Queue>> queues_;
+  std::vector<std::thread> workers_;
+  // Serializes concurrent calls to Run
+  std::mutex run_mutex_;
+  std::mutex mutex_;
+  std::condition_variable work_cv_;
+  std::condition_variable done_cv_;
+  size_t generation_;
+  bool stop_;
+  std::atomic<size_t> pending_;
+  std::exception_ptr error_;
+};
+
+}  // namespace ltl
+
+#endif  // LTL_THREAD_POOL_H_
@@ -0,0 +1,120 @@
+// Copyright (c) 2020 Klemens Esterle, Luis Gressenbuch
+//
+// This work is licensed under the terms of the MIT license.
+// For a copy, see <https://opensource.org/licenses/MIT>.
+
+#include "ltl/violation_log.h"
+
+#include <thread>
+
+#include "glog/logging.h"
+
+namespace ltl {
+
+ViolationLog::ViolationLog(size_t capacity, Policy policy)
+    : policy_(policy), step_(0), num_dropped_(0), push_pos_(0), pop_pos_(0) {
+  CHECK_GT(capacity, 0) << "Violation log needs a capacity!";
+  size_t size = 1;
+  while (size < capacity) {
+    size *= 2;
+  }
+  mask_ = size - 1;
+  cells_.reset(new Cell[size]);
+  for (size_t i = 0; i < size; ++i) {
+    cells_[i].sequence.store(i, std::memory_order_relaxed);
+  }
+}
+
+void ViolationLog::SetStep(uint64_t step) { step_ = step; }
+uint64_t ViolationLog::GetStep() const { return step_; }
+
+bool ViolationLog::Push(ViolationRecord record) {
+  return Push(record, step_.load(std::memory_order_relaxed));
+}
+
+bool ViolationLog::Push(ViolationRecord record, uint64_t step) {
+  record.step = step;
+  while (!TryPush(record)) {
+    if (policy_ == DROP) {
+      num_dropped_.fetch_add(1, std::memory_order_relaxed);
+      return false;
+    }
+    std::this_thread::yield();
+  }
+  return true;
+}
+
+size_t ViolationLog::Drain(ViolationRecord* records, size_t max_records) {
+  size_t n = 0;
+  while (n < max_records && TryPop(&records[n])) {
+    ++n;
+  }
+  return n;
+}
+
+size_t ViolationLog::Drain(std::vector<ViolationRecord>* records) {
+  size_t n = 0;
+  ViolationRecord record;
+  while (n < GetCapacity() && TryPop(&record)) {
+    records->push_back(record);
+    ++n;
+  }
+  return n;
+}
+
+bool ViolationLog::TryPush(const ViolationRecord& record) {
+  size_t pos = push_pos_.load(std::memory_order_relaxed);
+  Cell* cell;
+  while (true) {
+    cell = &cells_[pos & mask_];
+    const size_t sequence = cell->sequence.load(std::memory_order_acquire);
+    const intptr_t diff =
+        static_cast<intptr_t>(sequence) - static_cast<intptr_t>(pos);
+    if (diff == 0) {
+      if (push_pos_.compare_exchange_weak(pos, pos + 1,
+                                          std::memory_order_relaxed)) {
+        break;
+      }
+    } else if (diff < 0) {
+      // The cell still holds a record of the previous round
+      return false;
+    } else {
+      pos = push_pos_.load(std::memory_order_relaxed);
+    }
+  }
+  cell->record = record;
+  cell->sequence.store(pos + 1, std::memory_order_release);
+  return true;
+}
+
+bool ViolationLog::TryPop(ViolationRecord* record) {
+  size_t pos = pop_pos_.load(std::memory_order_relaxed);
+  Cell* cell;
+  while (true) {
+    cell = &cells_[pos & mask_];
+    const size_t sequence = cell->sequence.load(std::memory_order_acquire);
+    const intptr_t diff =
+        static_cast<intptr_t>(sequence) - static_cast<intptr_t>(pos + 1);
+    if (diff == 0) {
+      if (pop_pos_.compare_exchange_weak(pos, pos + 1,
+                                         std::memory_order_relaxed)) {
+        break;
+      }
+    } else if (diff < 0) {
+      // Empty
+      return false;
+    } else {
+      pos = pop_pos_.load(std::memory_order_relaxed);
+    }
+  }
+  *record = cell->record;
+  // Ready for the push one round later
+  cell->sequence.store(pos + mask_ + 1, std::memory_order_release);
+  return true;
+}
+
+size_t ViolationLog::GetCapacity() const { return mask_ + 1; }
+ViolationLog::Policy ViolationLog::GetPolicy() const { return policy_; }
+uint64_t ViolationLog::GetNumDropped() const { return num_dropped_; }
+
+}  // namespace ltl
@@ -0,0 +1,88 @@
+// Copyright (c) 2020 Klemens Esterle, Luis Gressenbuch
+//
+// This work is licensed under the terms of the MIT license.
+// For a copy, see <https://opensource.org/licenses/MIT>.
+
+#ifndef LTL_VIOLATION_LOG_H_
+#define LTL_VIOLATION_LOG_H_
+
+#include <atomic>
+#include <cstdint>
+#include <memory>
+#include <vector>
+
+namespace ltl {
+
+struct ViolationRecord {
+  static constexpr size_t kMaxArity = 4;
+
+  // Step of the ViolationLog when the violation was recorded
+  uint64_t step;
+  // Id passed to RuleMonitor::SetViolationLog
+  uint32_t rule_id;
+  // Automaton state in which the rule was violated
+  uint32_t automaton_state;
+  // Agent tuple of the rule state, unused entries are -1
+  int32_t agent_ids[kMaxArity];
+};
+
+/// Bounded queue of violations, filled by all rule states of the rules
+/// attached to it and drained in batches by the caller.
+///
+/// The queue is a lock-free ring buffer which may be filled from several
+/// threads, e.g. by a RuleEvaluator, while another thread drains it. If the
+/// buffer is full, DROP discards new records and counts them, BLOCK waits
+/// until the consumer made room. BLOCK requires draining from another thread.
+class ViolationLog {
+ public:
+  enum Policy { DROP, BLOCK };
+
+  /// \param capacity Rounded up to a power of two
+  explicit ViolationLog(size_t capacity, Policy policy = DROP);
+  ViolationLog(const ViolationLog&) = delete;
+  ViolationLog& operator=(const ViolationLog&) = delete;
+
+  /// Step stored in subsequent records, set once per timestep.
+  void SetStep(uint64_t step);
+  uint64_t GetStep() const;
+
+  /// Add a record, its step is set to the current step.
+  /// \return False if the record was dropped
+  bool Push(ViolationRecord record);
+  /// Add a record of the given step, e.g. of a recorded trace.
+  bool Push(ViolationRecord record, uint64_t step);
+  /// Remove up to max_records of the oldest records. Only one thread may
+  /// drain at a time.
+  /// \return Number of records written to records
+  size_t Drain(ViolationRecord* records, size_t max_records);
+  /// Append the records currently in the log, at most GetCapacity(), so
+  /// draining ends even while producers keep pushing.
+  size_t Drain(std::vector<ViolationRecord>* records);
+
+  size_t GetCapacity() const;
+  Policy GetPolicy() const;
+  /// Records discarded because the log was full.
+  uint64_t GetNumDropped() const;
+
+ private:
+  struct Cell {
+    // Position the cell is ready for: pos for a push, pos + 1 for a pop
+    std::atomic<size_t> sequence;
+    ViolationRecord record;
+  };
+
+  bool TryPush(const ViolationRecord& record);
+  bool TryPop(ViolationRecord* record);
+
+  std::unique_ptr<Cell[]> cells_;
+  size_t mask_;
+  Policy policy_;
+  std::atomic<uint64_t> step_;
+  std::atomic<uint64_t> num_dropped_;
+  alignas(64) std::atomic<size_t> push_pos_;
+  alignas(64) std::atomic<size_t> pop_pos_;
+};
+
+}  // namespace ltl
+
+#endif  // LTL_VIOLATION_LOG_H_
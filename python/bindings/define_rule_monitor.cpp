@@ -3,21 +3,123 @@
 // This work is licensed under the terms of the MIT license.
 // For a copy, see <https://opensource.org/licenses/MIT>.
 
+#include <algorithm>
+#include <limits>
 #include <memory>
+#include <sstream>
+#include <stdexcept>
 #include <string>
+#include <tuple>
+#include <vector>
 
 #include "define_rule_monitor.hpp"
 
 #include "bark/world/evaluation/ltl/label/label.h"
+#include "ltl/label_frame.h"
+#include "ltl/rule_library.h"
+#include "ltl/rule_metrics.h"
 #include "ltl/rule_monitor.h"
+#include "ltl/rule_state_set.h"
+#include "ltl/violation_log.h"
+#include "pybind11/numpy.h"
 
 namespace py = pybind11;
 using namespace ltl;
+
+// Label and penalty arrays are accessed in place. They are never converted to
+// another dtype or memory layout, mismatches raise an error instead. Agent ids
+// are few and converted to int32 if necessary.
+typedef py::array_t<bool, py::array::c_style> BoolArray;
+typedef py::array_t<double, py::array::c_style> DoubleArray;
+typedef py::array_t<uint32_t, py::array::c_style> StateArray;
+typedef py::array_t<int32_t, py::array::c_style> AgentIdArray;
+
+namespace {
+void CheckSize(const py::array &array, size_t size, const char *name) {
+  if (static_cast<size_t>(array.size()) != size) {
+    throw std::runtime_error(std::string("Array ") + name + " has " +
+                             std::to_string(array.size()) +
+                             " elements, expected " + std::to_string(size) +
+                             "!");
+  }
+}
+
+// Data of an optional array argument, nullptr if it is None
+template <typename T>
+T *GetData(const py::object &array, size_t size, const char *name) {
+  typedef py::array_t<T, py::array::c_style> Array;
+  if (array.is_none()) {
+    return nullptr;
+  }
+  if (!py::isinstance<Array>(array)) {
+    throw std::runtime_error(std::string("Array ") + name +
+                             " has the wrong dtype or is not C-contiguous!");
+  }
+  Array typed = array.cast<Array>();
+  CheckSize(typed, size, name);
+  return typed.mutable_data();
+}
+
+// Frames of a rule state set have one value per slot of the bound registry
+size_t GetNumSlots(const RuleStateSet &s) {
+  const auto &registry = s.GetMonitor()->GetLabelRegistry();
+  if (!registry) {
+    throw py::value_error("Rule " + s.GetMonitor()->GetStrFormula() +
+                          " has no bound labels!");
+  }
+  return registry->GetNumSlots();
+}
+
+std::vector<int> ToAgentIds(const AgentIdArray &agent_ids) {
+  return std::vector<int>(agent_ids.data(),
+                          agent_ids.data() + agent_ids.size());
+}
+}  // namespace
+
 void define_rule_monitor(py::module m) {
   py::class_<RuleMonitor, std::shared_ptr<RuleMonitor>>(m, "RuleMonitor")
       .def(py::init(&RuleMonitor::MakeRule))
       .def("MakeRule", &RuleMonitor::MakeRule)
-      .def("MakeRuleState", &RuleMonitor::MakeRuleState)
+      .def("MakeRuleState", &RuleMonitor::MakeRuleState,
+           py::arg("current_agent_ids") = std::vector<int>(),
+           py::arg("existing_agent_ids") = std::vector<int>())
+      .def("MakeRuleStateSet",
+           [](const RuleMonitor &m, const AgentIdArray &agent_ids) {
+             return m.MakeRuleStateSet(ToAgentIds(agent_ids));
+           },
+           py::arg("agent_ids") = AgentIdArray(0))
+      .def("BindLabels", &RuleMonitor::BindLabels)
+      // The label dict is converted while holding the GIL, evaluation
+      // releases it
+      .def("Evaluate",
+           py::overload_cast<const EvaluationMap &, RuleState &>(
+               &RuleMonitor::Evaluate, py::const_),
+           py::call_guard<py::gil_scoped_release>())
+      .def("EvaluateBatch",
+           [](const RuleMonitor &m, const EvaluationMap &labels,
+              const std::vector<RuleState *> &states) {
+             // None converts to nullptr
+             if (std::find(states.begin(), states.end(), nullptr) !=
+                 states.end()) {
+               throw py::value_error("Rule states must not be None!");
+             }
+             std::vector<double> penalties(states.size());
+             py::gil_scoped_release release;
+             m.EvaluateBatch(labels, states.data(), states.size(),
+                             penalties.data());
+             return penalties;
+           })
+      .def("FinalTransit", &RuleMonitor::FinalTransit,
+           py::call_guard<py::gil_scoped_release>())
+      .def("SetViolationLog", &RuleMonitor::SetViolationLog, py::arg("log"),
+           py::arg("rule_id") = 0)
+      .def("GetMetrics", &RuleMonitor::GetMetrics)
+      .def("ResetMetrics", &RuleMonitor::ResetMetrics)
+      .def("SetLatencyTracking", &RuleMonitor::SetLatencyTracking)
+      .def("GetSymmetries", &RuleMonitor::GetSymmetries)
+      .def("SetSymmetryReduction", &RuleMonitor::SetSymmetryReduction)
+      .def("GetMultiplicity", &RuleMonitor::GetMultiplicity)
+      .def("GetEquivalentAgentIds", &RuleMonitor::GetEquivalentAgentIds)
       .def("PrintToDot", &RuleMonitor::PrintToDot)
       .def("__repr__",
            [](const RuleMonitor &m) {
@@ -25,12 +127,21 @@ void define_rule_monitor(py::module m) {
              os << m;
              return os.str();
            })
+      .def("Serialize",
+           [](const RuleMonitor &m) { return py::bytes(m.Serialize()); })
+      .def_static("Deserialize",
+                  [](const py::bytes &data) {
+                    return RuleMonitor::Deserialize(std::string(data));
+                  })
       .def(py::pickle(
           [](const RuleMonitor &b) {
-            return py::make_tuple(b.GetStrFormula(), b.GetWeight(),
-                                  b.GetPriority());
+            // Pickle the compiled rule, so unpickling does not invoke Spot
+            return py::make_tuple(py::bytes(b.Serialize()));
           },
           [](py::tuple t) {
+            if (t.size() == 1) {
+              return RuleMonitor::Deserialize(t[0].cast<std::string>());
+            }
             if (t.size() != 3)
               throw std::runtime_error("Invalid RuleMonitor evaluator state!");
             return RuleMonitor::MakeRule(
@@ -38,11 +149,247 @@ void define_rule_monitor(py::module m) {
                 t[2].cast<RulePriority>());
           }));
 
+  py::class_<RuleMetrics>(m, "RuleMetrics")
+      .def_readonly("steps", &RuleMetrics::steps)
+      .def_readonly("transitions", &RuleMetrics::transitions)
+      .def_readonly("violations", &RuleMetrics::violations)
+      .def_readonly("resets", &RuleMetrics::resets)
+      .def_readonly("undefined", &RuleMetrics::undefined)
+      .def_readonly("instances", &RuleMetrics::instances)
+      .def_readonly("latency_histogram", &RuleMetrics::latency_histogram)
+      .def("__repr__", [](const RuleMetrics &metrics) {
+        std::stringstream os;
+        os << metrics;
+        return os.str();
+      });
+
   py::class_<RuleState, std::shared_ptr<RuleState>>(m, "RuleState")
       .def_property_readonly("automaton", &RuleState::GetAutomaton)
       .def_property_readonly("current_state", &RuleState::GetCurrentState)
       .def_property_readonly("violation_count", &RuleState::GetViolationCount);
 
+  py::class_<LabelRegistry, std::shared_ptr<LabelRegistry>>(m,
+                                                            "LabelRegistry")
+      .def(py::init<>())
+      .def("Register",
+           py::overload_cast<const Label &>(&LabelRegistry::Register))
+      .def("Register", py::overload_cast<int, int>(&LabelRegistry::Register),
+           py::arg("name_idx"), py::arg("agent_idx"))
+      .def("GetSlot",
+           py::overload_cast<const Label &>(&LabelRegistry::GetSlot,
+                                            py::const_))
+      .def("GetSlot",
+           py::overload_cast<int, int>(&LabelRegistry::GetSlot, py::const_),
+           py::arg("name_idx"), py::arg("agent_idx"))
+      .def("GetLabel", &LabelRegistry::GetLabel)
+      .def("RegisterAgent", &LabelRegistry::RegisterAgent)
+      .def("GetAgentIndex", &LabelRegistry::GetAgentIndex)
+      .def("GetAgentId", &LabelRegistry::GetAgentId)
+      .def("RegisterAgentLabel", &LabelRegistry::RegisterAgentLabel)
+      .def("GetAgentLabelIndex", &LabelRegistry::GetAgentLabelIndex)
+      .def_property_readonly("num_slots", &LabelRegistry::GetNumSlots)
+      .def_property_readonly("num_agents", &LabelRegistry::GetNumAgents);
+
+  // Evaluation on NumPy arrays. Labels are bool arrays indexed by the slots of
+  // the LabelRegistry bound to the rule, i.e. frames of shape (num_slots,) and
+  // traces of shape (num_steps, num_slots). Agent ids are int32 arrays. The
+  // GIL is released while evaluating, a RuleStateSet must not be used by
+  // several Python threads at the same time.
+  py::class_<RuleStateSet, std::shared_ptr<RuleStateSet>> rule_state_set(
+      m, "RuleStateSet");
+  // Opaque, only passed back to RestoreSnapshot
+  py::class_<RuleStateSet::Snapshot>(rule_state_set, "Snapshot");
+  rule_state_set
+      .def("AddAgents",
+           [](RuleStateSet &s, const AgentIdArray &agent_ids) {
+             s.AddAgents(ToAgentIds(agent_ids));
+           })
+      .def("RemoveAgents",
+           [](RuleStateSet &s, const AgentIdArray &agent_ids) {
+             s.RemoveAgents(ToAgentIds(agent_ids));
+           })
+      .def("Evaluate",
+           [](RuleStateSet &s, const BoolArray &values,
+              const py::object &defined, const py::object &penalties) {
+             const size_t num_slots = GetNumSlots(s);
+             if (values.ndim() != 1 ||
+                 static_cast<size_t>(values.size()) != num_slots) {
+               throw py::value_error(
+                   "Array values has to be one-dimensional with " +
+                   std::to_string(num_slots) + " elements!");
+             }
+             const bool *defined_data =
+                 GetData<bool>(defined, num_slots, "defined");
+             double *penalties_data =
+                 GetData<double>(penalties, s.Size(), "penalties");
+             LabelFrame frame(num_slots);
+             double sum;
+             {
+               py::gil_scoped_release release;
+               frame.Assign(reinterpret_cast<const uint8_t *>(values.data()),
+                            reinterpret_cast<const uint8_t *>(defined_data));
+               sum = s.Evaluate(frame, 0, s.Size(), penalties_data);
+             }
+             return sum;
+           },
+           py::arg("values").noconvert(), py::arg("defined") = py::none(),
+           py::arg("penalties") = py::none())
+      .def("EvaluateTrace",
+           [](RuleStateSet &s, const BoolArray &values,
+              const py::object &defined, DoubleArray step_penalties) {
+             if (values.ndim() != 2) {
+               throw std::runtime_error("Trace must have two dimensions!");
+             }
+             const size_t num_steps = values.shape(0);
+             const size_t num_slots = values.shape(1);
+             if (num_slots != GetNumSlots(s)) {
+               throw py::value_error("Trace has " + std::to_string(num_slots) +
+                                     " slots, expected " +
+                                     std::to_string(GetNumSlots(s)) + "!");
+             }
+             const bool *defined_data =
+                 GetData<bool>(defined, num_steps * num_slots, "defined");
+             CheckSize(step_penalties, num_steps, "step_penalties");
+             RuleStateSet::TraceResult result;
+             {
+               py::gil_scoped_release release;
+               LabelTrace trace(num_steps, num_slots);
+               trace.Assign(reinterpret_cast<const uint8_t *>(values.data()),
+                            reinterpret_cast<const uint8_t *>(defined_data));
+               s.EvaluateTrace(trace, &result);
+             }
+             std::copy(result.step_penalties.begin(),
+                       result.step_penalties.end(),
+                       step_penalties.mutable_data());
+             // Violations as (step, instance) rows
+             py::array_t<int64_t> violations(
+                 {static_cast<py::ssize_t>(result.violations.size()),
+                  static_cast<py::ssize_t>(2)});
+             auto v = violations.mutable_unchecked<2>();
+             for (size_t i = 0; i < result.violations.size(); ++i) {
+               v(i, 0) = result.violations[i].step;
+               v(i, 1) = result.violations[i].instance;
+             }
+             return violations;
+           },
+           py::arg("values").noconvert(), py::arg("defined") = py::none(),
+           py::arg("step_penalties").noconvert())
+      .def("FinalTransit",
+           [](const RuleStateSet &s, DoubleArray penalties) {
+             // One entry per instance, followed by the parked instances
+             const size_t num_instances = s.Size() + s.GetNumParked();
+             CheckSize(penalties, num_instances, "penalties");
+             double *data = penalties.mutable_data();
+             py::gil_scoped_release release;
+             double sum = 0.0;
+             for (size_t i = 0; i < num_instances; ++i) {
+               data[i] = s.GetFinalPenalty(i);
+               sum += data[i];
+             }
+             return sum;
+           },
+           py::arg("penalties").noconvert())
+      .def("GetCurrentStates",
+           [](const RuleStateSet &s, StateArray states) {
+             CheckSize(states, s.Size(), "states");
+             uint32_t *data = states.mutable_data();
+             for (size_t i = 0; i < s.Size(); ++i) {
+               data[i] = s.GetCurrentState(i);
+             }
+           },
+           py::arg("states").noconvert())
+      .def("GetRuleState", &RuleStateSet::GetRuleState)
+      .def("SaveSnapshot",
+           py::overload_cast<>(&RuleStateSet::SaveSnapshot))
+      .def("RestoreSnapshot", &RuleStateSet::RestoreSnapshot)
+      .def_property_readonly(
+          "agent_ids",
+          [](const RuleStateSet &s) {
+            AgentIdArray agent_ids(
+                {static_cast<py::ssize_t>(s.Size()),
+                 static_cast<py::ssize_t>(s.GetArity())});
+            if (s.Size() > 0) {
+              std::copy_n(s.GetAgentIds(0), s.Size() * s.GetArity(),
+                          agent_ids.mutable_data());
+            }
+            return agent_ids;
+          })
+      .def_property_readonly("arity", &RuleStateSet::GetArity)
+      .def("__len__", &RuleStateSet::Size);
+
+  py::class_<ViolationLog, std::shared_ptr<ViolationLog>> violation_log(
+      m, "ViolationLog");
+  py::enum_<ViolationLog::Policy>(violation_log, "Policy")
+      .value("DROP", ViolationLog::DROP)
+      .value("BLOCK", ViolationLog::BLOCK);
+  violation_log
+      .def(py::init<size_t, ViolationLog::Policy>(), py::arg("capacity"),
+           py::arg("policy") = ViolationLog::DROP)
+      .def("SetStep", &ViolationLog::SetStep)
+      // Records as rows of step, rule id, automaton state and the agent
+      // tuple padded with -1
+      .def(
+          "Drain",
+          [](ViolationLog &log, size_t max_records) {
+            std::vector<ViolationRecord> records(
+                std::min(max_records, log.GetCapacity()));
+            size_t n;
+            {
+              py::gil_scoped_release release;
+              n = log.Drain(records.data(), records.size());
+            }
+            const size_t num_columns = 3 + ViolationRecord::kMaxArity;
+            py::array_t<int64_t> rows({static_cast<py::ssize_t>(n),
+                                       static_cast<py::ssize_t>(num_columns)});
+            auto r = rows.mutable_unchecked<2>();
+            for (size_t i = 0; i < n; ++i) {
+              r(i, 0) = records[i].step;
+              r(i, 1) = records[i].rule_id;
+              r(i, 2) = records[i].automaton_state;
+              for (size_t a = 0; a < ViolationRecord::kMaxArity; ++a) {
+                r(i, 3 + a) = records[i].agent_ids[a];
+              }
+            }
+            return rows;
+          },
+          py::arg("max_records") = std::numeric_limits<size_t>::max())
+      .def_property_readonly("step", &ViolationLog::GetStep)
+      .def_property_readonly("capacity", &ViolationLog::GetCapacity)
+      .def_property_readonly("policy", &ViolationLog::GetPolicy)
+      .def_property_readonly("num_dropped", &ViolationLog::GetNumDropped);
+
+  py::class_<RuleLibrary>(m, "RuleLibrary")
+      .def_static("Save", &RuleLibrary::Save,
+                  py::call_guard<py::gil_scoped_release>())
+      .def_static("Load",
+                  py::overload_cast<const std::string &>(&RuleLibrary::Load),
+                  py::call_guard<py::gil_scoped_release>())
+      .def_static("SaveShared", &RuleLibrary::SaveShared,
+                  py::call_guard<py::gil_scoped_release>())
+      .def_static("AttachShared", &RuleLibrary::AttachShared,
+                  py::call_guard<py::gil_scoped_release>())
+      .def_static("UnlinkShared", &RuleLibrary::UnlinkShared);
+
+  // Specs are (formula, weight, priority) tuples
+  py::class_<RuleLoader, std::shared_ptr<RuleLoader>>(m, "RuleLoader")
+      .def(py::init([](const std::vector<std::tuple<std::string, double,
+                                                     RulePriority>> &specs) {
+             std::vector<RuleSpec> rule_specs;
+             for (const auto &spec : specs) {
+               rule_specs.push_back({std::get<0>(spec), std::get<1>(spec),
+                                     std::get<2>(spec)});
+             }
+             return std::make_shared<RuleLoader>(std::move(rule_specs));
+           }),
+           py::arg("specs"))
+      .def("GetRule",
+           [](const RuleLoader &l, size_t idx) { return l.GetRule(idx).get(); },
+           py::call_guard<py::gil_scoped_release>())
+      .def("IsReady", &RuleLoader::IsReady)
+      .def("GetAll", &RuleLoader::GetAll,
+           py::call_guard<py::gil_scoped_release>())
+      .def("__len__", &RuleLoader::Size);
+
   // TODO(@fortiss): Move to BARK repo
   py::class_<Label, std::shared_ptr<Label>>(m, "Label")
       .def(py::init<const std::string &, int>())
@@ -0,0 +1,77 @@
+# Copyright (c) 2020 Klemens Esterle, Luis Gressenbuch
+#
+# This work is licensed under the terms of the MIT license.
+# For a copy, see <https://opensource.org/licenses/MIT>.
+# ========================================================
+
+import os
+import unittest
+from concurrent.futures import ThreadPoolExecutor
+
+from test_module_rule_monitor import (Label, RuleLibrary, RuleLoader,
+                                      RuleMonitor)
+
+
+class EvaluateTest(unittest.TestCase):
+  def test_evaluate(self):
+    rule = RuleMonitor("G (a#0 & b)", -1.0, 0)
+    states = rule.MakeRuleState([1, 2])
+    labels = {Label("a", 1): True, Label("a", 2): False, Label("b"): True}
+    self.assertEqual(rule.Evaluate(labels, states[0]), 0.0)
+    self.assertEqual(rule.EvaluateBatch(labels, states), [0.0, -1.0])
+    self.assertEqual(states[1].violation_count, 1)
+    with self.assertRaises(ValueError):
+      rule.EvaluateBatch(labels, [states[0], None])
+    self.assertEqual(rule.FinalTransit(states[0]), 0.0)
+
+  def test_corrupt_pickle(self):
+    rule = RuleMonitor("G (a#0 & b)", -1.0, 0)
+    data = rule.Serialize()
+    with self.assertRaises(ValueError):
+      RuleMonitor.Deserialize(data[:-1])
+    # What unpickling does with the state returned by __getstate__
+    restored = RuleMonitor.__new__(RuleMonitor)
+    with self.assertRaises(ValueError):
+      restored.__setstate__((data[:-1],))
+
+  def test_evaluate_threads(self):
+    rule = RuleMonitor("G a", -1.0, 0)
+    states = [rule.MakeRuleState()[0] for _ in range(8)]
+    labels = {Label("a"): False}
+    with ThreadPoolExecutor(max_workers=4) as pool:
+      penalties = list(
+          pool.map(lambda state: rule.Evaluate(labels, state), states))
+    self.assertEqual(penalties, [-1.0] * 8)
+
+  def test_metrics(self):
+    rule = RuleMonitor("G a", -1.0, 0)
+    rule.SetLatencyTracking(True)
+    states = [rule.MakeRuleState()[0] for _ in range(8)]
+    with ThreadPoolExecutor(max_workers=4) as pool:
+      list(pool.map(lambda state: rule.Evaluate({Label("a"): False}, state),
+                    states))
+    metrics = rule.GetMetrics()
+    self.assertEqual(metrics.steps, 8)
+    self.assertEqual(metrics.violations, 8)
+    self.assertEqual(metrics.instances, 8)
+    self.assertEqual(sum(metrics.latency_histogram), 8)
+
+  def test_rule_loader(self):
+    loader = RuleLoader([("G a", -1.0, 0), ("G (a#0 & b)", -2.0, 1)])
+    self.assertEqual(len(loader), 2)
+    rule = loader.GetRule(1)
+    self.assertEqual(len(rule.MakeRuleState([1, 2])), 2)
+    self.assertTrue(loader.IsReady(1))
+    self.assertEqual(len(loader.GetAll()), 2)
+
+  def test_shared_library(self):
+    name = "/ltl_evaluate_test_{}".format(os.getpid())
+    RuleLibrary.SaveShared(name, [RuleMonitor("G a", -1.0, 0)])
+    rules = RuleLibrary.AttachShared(name)
+    RuleLibrary.UnlinkShared(name)
+    state = rules[0].MakeRuleState()[0]
+    self.assertEqual(rules[0].Evaluate({Label("a"): False}, state), -1.0)
+
+
+if __name__ == '__main__':
+  unittest.main()
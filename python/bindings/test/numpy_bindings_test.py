@@ -0,0 +1,104 @@
+# Copyright (c) 2020 Klemens Esterle, Luis Gressenbuch
+#
+# This work is licensed under the terms of the MIT license.
+# For a copy, see <https://opensource.org/licenses/MIT>.
+# ========================================================
+
+import unittest
+
+import numpy as np
+
+from test_module_rule_monitor import (Label, LabelRegistry, RuleMonitor,
+                                      ViolationLog)
+
+
+class NumpyBindingsTest(unittest.TestCase):
+  def test_evaluate_frame(self):
+    registry = LabelRegistry()
+    rule = RuleMonitor("G (a#0 & b)", -1.0, 0)
+    rule.BindLabels(registry)
+    states = rule.MakeRuleStateSet(np.array([1, 2], dtype=np.int32))
+    self.assertEqual(len(states), 2)
+    values = np.zeros(registry.num_slots, dtype=bool)
+    values[registry.GetSlot(Label("a", 2))] = True
+    values[registry.GetSlot(Label("b"))] = True
+    penalties = np.zeros(len(states))
+    self.assertEqual(states.Evaluate(values, penalties=penalties), -1.0)
+    np.testing.assert_array_equal(penalties, [-1.0, 0.0])
+    current_states = np.zeros(len(states), dtype=np.uint32)
+    states.GetCurrentStates(current_states)
+    with self.assertRaises(TypeError):
+      states.Evaluate(values.astype(np.int8))
+    with self.assertRaises(ValueError):
+      states.Evaluate(values[:-1])
+    with self.assertRaises(ValueError):
+      states.Evaluate(values.reshape(1, -1))
+
+  def test_agent_label_table(self):
+    registry = LabelRegistry()
+    rule = RuleMonitor("G (a#0 & b)", -1.0, 0)
+    rule.BindLabels(registry)
+    states = rule.MakeRuleStateSet(np.array([40, 2], dtype=np.int32))
+    self.assertEqual(registry.num_agents, 2)
+    a = registry.GetAgentLabelIndex("a")
+    values = np.zeros(registry.num_slots, dtype=bool)
+    values[registry.GetSlot(a, registry.GetAgentIndex(2))] = True
+    values[registry.GetSlot(Label("b"))] = True
+    penalties = np.zeros(len(states))
+    states.Evaluate(values, penalties=penalties)
+    # Instances are ordered by agent id
+    np.testing.assert_array_equal(penalties, [0.0, -1.0])
+    self.assertEqual(registry.GetSlot(a, -1), -1)
+    self.assertEqual(registry.GetSlot(-1, 0), -1)
+    with self.assertRaises(IndexError):
+      registry.Register(a, registry.num_agents)
+
+  def test_evaluate_trace(self):
+    registry = LabelRegistry()
+    rule = RuleMonitor("G (a#0 & b)", -1.0, 0)
+    rule.BindLabels(registry)
+    states = rule.MakeRuleStateSet(np.array([1, 2, 3], dtype=np.int32))
+    trace = np.ones((4, registry.num_slots), dtype=bool)
+    trace[2, registry.GetSlot(Label("a", 3))] = False
+    step_penalties = np.zeros(4)
+    violations = states.EvaluateTrace(trace, step_penalties=step_penalties)
+    np.testing.assert_array_equal(step_penalties, [0.0, 0.0, -1.0, 0.0])
+    np.testing.assert_array_equal(violations, [[2, 2]])
+
+  def test_snapshot(self):
+    registry = LabelRegistry()
+    rule = RuleMonitor("G (a#0 & b)", -1.0, 0)
+    rule.BindLabels(registry)
+    states = rule.MakeRuleStateSet(np.array([1, 2], dtype=np.int32))
+    values = np.ones(registry.num_slots, dtype=bool)
+    values[registry.GetSlot(Label("a", 2))] = False
+    snapshot = states.SaveSnapshot()
+    self.assertEqual(states.Evaluate(values), -1.0)
+    states.RemoveAgents(np.array([1], dtype=np.int32))
+    states.RestoreSnapshot(snapshot)
+    self.assertEqual(len(states), 2)
+    np.testing.assert_array_equal(states.agent_ids, [[1], [2]])
+    self.assertEqual(states.GetRuleState(1).violation_count, 0)
+
+  def test_violation_log(self):
+    registry = LabelRegistry()
+    rule = RuleMonitor("G (a#0 & b)", -1.0, 0)
+    rule.BindLabels(registry)
+    log = ViolationLog(8, ViolationLog.Policy.DROP)
+    rule.SetViolationLog(log, 3)
+    states = rule.MakeRuleStateSet(np.array([1, 2], dtype=np.int32))
+    values = np.zeros(registry.num_slots, dtype=bool)
+    values[registry.GetSlot(Label("a", 2))] = True
+    values[registry.GetSlot(Label("b"))] = True
+    for step in range(10):
+      log.SetStep(step)
+      states.Evaluate(values)
+    self.assertEqual(log.num_dropped, 2)
+    rows = log.Drain(5)
+    self.assertEqual(rows.shape, (5, 7))
+    # Step, rule id and the agent tuple of the first violation
+    np.testing.assert_array_equal(rows[0, [0, 1, 3, 4]], [0, 3, 1, -1])
+    self.assertEqual(len(log.Drain()), 3)
+
+if __name__ == '__main__':
+  unittest.main()
@@ -77,6 +77,13 @@ cc_library(
     ],
     )
 
+    _maybe(
+      git_repository,
+      name = "com_github_google_benchmark",
+      tag = "v1.5.2",
+      remote = "https://github.com/google/benchmark"
+    )
+
     _maybe(
     http_archive,
     name = "spot",